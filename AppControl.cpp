@@ -5,6 +5,7 @@
 const std::wstring _appMutexNameSuffix= L"Mutex";
 const std::wstring _exitEventNameSuffix = L"ExitEvent";
 const std::wstring _initEventNameSuffix = L"InitEvent";
+constexpr UINT _shutdownTimeoutExitCode = 2;
 
 AppControl::AppControl(std::wstring appId)
 {
@@ -23,6 +24,10 @@ AppControl::AppControl(std::wstring appId)
 	_appMutex = CreateMutex(nullptr, true, (_appId + _appMutexNameSuffix).c_str());
 	if (_appMutex == INVALID_HANDLE_VALUE)
 		throw std::exception("Error creating mutex.", static_cast<int>(GetLastError()));
+
+	_shutdownCompleteEvent = CreateEvent(nullptr, true, false, nullptr);
+	if (_shutdownCompleteEvent == nullptr)
+		throw std::exception("Error creating shutdown event.", static_cast<int>(GetLastError()));
 }
 
 bool AppControl::IsUniqueInstance() const
@@ -45,8 +50,33 @@ void AppControl::ExitApp() const
 	SetEvent(_exitEvent);
 }
 
+// Bounds the rest of the shutdown: unless this object is destroyed within the timeout,
+// the process is terminated, whatever it is stuck on.
+void AppControl::ArmShutdownWatchdog(const DWORD timeoutMs)
+{
+	if (_watchdog.joinable())
+		return;
+
+	_watchdog = std::thread([this, timeoutMs]
+	{
+		if (WaitForSingleObject(_shutdownCompleteEvent, timeoutMs) == WAIT_OBJECT_0)
+			return;
+
+		OutputDebugStringA("Shutdown timed out, terminating.\n");
+		TerminateProcess(GetCurrentProcess(), _shutdownTimeoutExitCode);
+	});
+}
+
 AppControl::~AppControl()
 {
+	if (_watchdog.joinable())
+	{
+		SetEvent(_shutdownCompleteEvent);
+		_watchdog.join();
+	}
+
+	CloseHandle(_shutdownCompleteEvent);
 	CloseHandle(_appMutex);
 	CloseHandle(_exitEvent);
+	CloseHandle(_initEvent);
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <string>
+#include <thread>
 #include <Windows.h>
 
 class AppControl
@@ -16,10 +17,13 @@ public:
 	void SetInitComplete() const;
 	void WaitForExitCommand() const;
 	void ExitApp() const;
+	void ArmShutdownWatchdog(DWORD timeoutMs);
 
 private:
 	std::wstring _appId;
 	HANDLE _exitEvent;
 	HANDLE _initEvent;
 	HANDLE _appMutex;
+	HANDLE _shutdownCompleteEvent;
+	std::thread _watchdog;
 };
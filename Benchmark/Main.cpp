@@ -0,0 +1,213 @@
+// ReSharper disable CppInconsistentNaming
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Windows.h>
+
+#include "../error_code_exception.h"
+#include "../Client/PipeClient.h"
+
+// Pipelines ChangeLayout and QueryUsage calls against a running server and reports the
+// round-trip latency percentiles and the throughput.
+// Usage: NativeLangHookBenchmark [--pipe <name>] [--count <calls>] [--depth <calls in flight>]
+// The server takes one client and exits when it leaves, so the benchmark ends with Exit.
+
+constexpr int DefaultCount = 10000;
+constexpr int DefaultDepth = 32;
+constexpr auto CallTimeout = std::chrono::seconds(5);
+constexpr int BenchmarkLayouts[] = { 0x0409, 0x0419 };
+
+struct BenchmarkOptions
+{
+	std::wstring PipeName;
+	int Count;
+	int Depth;
+};
+
+// One call in flight; only the future of its kind is valid.
+struct InFlightCall
+{
+	bool IsQuery;
+	LARGE_INTEGER IssuedAt;
+	std::future<void> Completed;
+	std::future<std::vector<BYTE>> Reply;
+};
+
+BenchmarkOptions ParseCommandLine(int argc, wchar_t* argv[]);
+HWND CreateTargetWindow(std::promise<HWND>& created);
+double Percentile(const std::vector<double>& sortedUs, double fraction);
+
+int wmain(const int argc, wchar_t* argv[])
+{
+	const auto options = ParseCommandLine(argc, argv);
+
+	// ChangeLayout targets a hidden window of ours, so no other application is switched.
+	std::promise<HWND> targetCreated;
+	auto targetWindow = targetCreated.get_future();
+	std::thread targetThread(CreateTargetWindow, std::ref(targetCreated));
+	const auto target = targetWindow.get();
+	if (target == nullptr)
+	{
+		targetThread.join();
+		printf("Error creating target window: %lu\n", GetLastError());
+		return 1;
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	std::vector<double> latenciesUs;
+	latenciesUs.reserve(options.Count);
+	auto failedCalls = 0;
+	auto isTimedOut = false;
+	LARGE_INTEGER startedAt, finishedAt;
+
+	{
+		PipeClient client(options.PipeName);
+		client.Start();
+
+		// The first call waits for the connection, it is not measured.
+		if (client.QueryUsage().wait_for(CallTimeout) != std::future_status::ready)
+		{
+			printf("No reply from the server within %lld s\n", static_cast<long long>(CallTimeout.count()));
+			PostMessage(target, WM_CLOSE, 0, 0);
+			targetThread.join();
+			return 3;
+		}
+
+		std::deque<InFlightCall> inFlight;
+		QueryPerformanceCounter(&startedAt);
+
+		for (auto issued = 0, completed = 0; completed < options.Count;)
+		{
+			if (issued < options.Count && static_cast<int>(inFlight.size()) < options.Depth)
+			{
+				InFlightCall call{};
+				call.IsQuery = issued % 2 != 0;
+				QueryPerformanceCounter(&call.IssuedAt);
+
+				if (call.IsQuery)
+					call.Reply = client.QueryUsage();
+				else
+				{
+					const auto layout = BenchmarkLayouts[issued / 2 % std::size(BenchmarkLayouts)];
+					call.Completed = client.ChangeLayout(target, layout, layout);
+				}
+
+				inFlight.push_back(std::move(call));
+				issued++;
+				continue;
+			}
+
+			// The server answers in order, so the oldest call is the next to complete.
+			auto call = std::move(inFlight.front());
+			inFlight.pop_front();
+
+			// A server that stopped answering ends the run instead of hanging it.
+			const auto status = call.IsQuery ? call.Reply.wait_for(CallTimeout) : call.Completed.wait_for(CallTimeout);
+			if (status != std::future_status::ready)
+			{
+				isTimedOut = true;
+				break;
+			}
+
+			try
+			{
+				if (call.IsQuery)
+					call.Reply.get();
+				else
+					call.Completed.get();
+			}
+			catch (error_code_exception&)
+			{
+				failedCalls++;
+			}
+
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			latenciesUs.push_back(static_cast<double>(now.QuadPart - call.IssuedAt.QuadPart) * 1000000.0 / static_cast<double>(frequency.QuadPart));
+			completed++;
+		}
+
+		QueryPerformanceCounter(&finishedAt);
+		if (isTimedOut)
+			printf("No reply within %lld s after %zu calls, stopped\n", static_cast<long long>(CallTimeout.count()), latenciesUs.size());
+
+		const auto statistics = client.getStatistics();
+		printf("client: %llu frames sent, %llu replies, %llu reconnects, send %.1f us mean / %.1f us max, reply %.1f us mean\n",
+			statistics.FramesSent, statistics.RepliesReceived, statistics.Reconnects,
+			statistics.MeanSendLatencyUs, statistics.MaxSendLatencyUs, statistics.MeanReplyLatencyUs);
+
+		client.Exit().wait_for(std::chrono::seconds(1));
+	}
+
+	PostMessage(target, WM_CLOSE, 0, 0);
+	targetThread.join();
+
+	std::sort(latenciesUs.begin(), latenciesUs.end());
+	const auto elapsedSeconds = static_cast<double>(finishedAt.QuadPart - startedAt.QuadPart) / static_cast<double>(frequency.QuadPart);
+
+	const auto completedCalls = static_cast<int>(latenciesUs.size());
+	printf("%d calls, depth %d, %d failed\n", completedCalls, options.Depth, failedCalls);
+	printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		Percentile(latenciesUs, 0.5), Percentile(latenciesUs, 0.99), latenciesUs.empty() ? 0.0 : latenciesUs.back());
+	printf("throughput: %.0f calls/s\n", elapsedSeconds > 0 ? completedCalls / elapsedSeconds : 0.0);
+	if (isTimedOut)
+		return 3;
+	return failedCalls == 0 ? 0 : 2;
+}
+
+BenchmarkOptions ParseCommandLine(const int argc, wchar_t* argv[])
+{
+	BenchmarkOptions options{ ServerPipeName, DefaultCount, DefaultDepth };
+
+	for (auto i = 1; i < argc; i++)
+	{
+		const std::wstring arg = argv[i];
+		if (arg == L"--pipe" && i + 1 < argc)
+			options.PipeName = argv[++i];
+		else if (arg == L"--count" && i + 1 < argc)
+			options.Count = (std::max)(1, _wtoi(argv[++i]));
+		else if (arg == L"--depth" && i + 1 < argc)
+			options.Depth = (std::max)(1, _wtoi(argv[++i]));
+	}
+
+	return options;
+}
+
+// Message-only window with its own pump: the hook handles the requests sent to it.
+HWND CreateTargetWindow(std::promise<HWND>& created)
+{
+	const auto window = CreateWindowEx(0, L"STATIC", L"NativeLangHookBenchmark", 0, 0, 0, 0, 0,
+		HWND_MESSAGE, nullptr, GetModuleHandle(nullptr), nullptr);
+	created.set_value(window);
+	if (window == nullptr)
+		return nullptr;
+
+	MSG msg;
+	while (GetMessage(&msg, nullptr, 0, 0) > 0)
+	{
+		if (msg.message == WM_CLOSE && msg.hwnd == window)
+		{
+			DestroyWindow(window);
+			break;
+		}
+		DispatchMessage(&msg);
+	}
+
+	return window;
+}
+
+double Percentile(const std::vector<double>& sortedUs, const double fraction)
+{
+	if (sortedUs.empty())
+		return 0;
+
+	const auto index = static_cast<size_t>(fraction * static_cast<double>(sortedUs.size() - 1) + 0.5);
+	return sortedUs[(std::min)(index, sortedUs.size() - 1)];
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <thread>
+#include <Windows.h>
+
+#include "error_code_exception.h"
+
+// How long a stopping component waits for each of its threads.
+constexpr DWORD ThreadStopTimeout = 500;
+constexpr UINT ThreadStopTimeoutExitCode = 3;
+
+// Shutdown signal shared by all server threads. Its handle goes into every wait of a
+// worker loop, so cancelling it wakes them all at once, whatever they are blocked on.
+class CancellationToken
+{
+public:
+	CancellationToken();
+	CancellationToken(const CancellationToken &ct) = delete;
+	~CancellationToken();
+
+	void Cancel() const;
+	bool IsCancelled() const;
+	HANDLE getHandle() const;
+
+private:
+	HANDLE _event;
+};
+
+inline CancellationToken::CancellationToken()
+{
+	_event = CreateEvent(nullptr, true, false, nullptr);
+	if (_event == nullptr)
+		throw error_code_exception("Error creating cancellation event.", static_cast<int>(GetLastError()));
+}
+
+inline void CancellationToken::Cancel() const
+{
+	SetEvent(_event);
+}
+
+inline bool CancellationToken::IsCancelled() const
+{
+	return WaitForSingleObject(_event, 0) == WAIT_OBJECT_0;
+}
+
+inline HANDLE CancellationToken::getHandle() const
+{
+	return _event;
+}
+
+inline CancellationToken::~CancellationToken()
+{
+	CloseHandle(_event);
+}
+
+// Joins the thread, or terminates the process if it is still running after the timeout.
+// A thread left running would use the objects its owner is about to destroy, so the
+// process ends right here, before any destructor runs.
+inline void JoinThread(std::thread& thread, const DWORD timeoutMs)
+{
+	if (!thread.joinable())
+		return;
+
+	if (WaitForSingleObject(thread.native_handle(), timeoutMs) != WAIT_OBJECT_0)
+	{
+		OutputDebugStringA("Thread stop timed out, terminating.\n");
+		TerminateProcess(GetCurrentProcess(), ThreadStopTimeoutExitCode);
+	}
+
+	thread.join();
+}
@@ -0,0 +1,522 @@
+﻿// ReSharper disable CppInconsistentNaming
+// ReSharper disable IdentifierTypo
+#include "PipeClient.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "../error_code_exception.h"
+
+constexpr DWORD ReconnectMinDelay = 50;
+constexpr DWORD ReconnectMaxDelay = 2000;
+constexpr DWORD WriteRetryMinDelay = 10;
+constexpr DWORD WriteRetryMaxDelay = 1000;
+constexpr DWORD ReadChunkSize = 512;
+
+PipeClient::PipeClient(const std::wstring& pipeName)
+	: _pipeName{PipeNamePrefix + pipeName}, _pipe{INVALID_HANDLE_VALUE},
+	_isConnected{false}, _isStopping{false}, _hasConnected{false}, _lastRequestId{0}, _statistics{}, _sendLatencyTotalUs{0}, _replyLatencyTotalUs{0}
+{
+	QueryPerformanceFrequency(&_frequency);
+
+	_stopEvent = CreateEvent(nullptr, true, false, nullptr);
+	_readEvent = CreateEvent(nullptr, true, false, nullptr);
+	_writeEvent = CreateEvent(nullptr, true, false, nullptr);
+	if (_stopEvent == nullptr || _readEvent == nullptr || _writeEvent == nullptr)
+		throw error_code_exception("Error creating event.", static_cast<int>(GetLastError()));
+}
+
+// The callbacks are read by the reader thread without a lock, so they are set before it starts.
+void PipeClient::Start()
+{
+	_readerThread = std::thread(&PipeClient::ReaderTask, this);
+	_writerThread = std::thread(&PipeClient::WriterTask, this);
+}
+
+std::future<void> PipeClient::ChangeLayout(HWND hWnd, const int klId, const int hkl)
+{
+	const int args[] = { static_cast<int>(reinterpret_cast<INT_PTR>(hWnd)), klId, hkl };
+	const auto completed = std::make_shared<std::promise<void>>();
+
+	Enqueue(Command::ChangeLayout, args, sizeof args, [completed](const std::vector<BYTE>&, const std::exception_ptr& error)
+	{
+		if (error != nullptr)
+			completed->set_exception(error);
+		else
+			completed->set_value();
+	});
+	return completed->get_future();
+}
+
+std::future<void> PipeClient::Exit()
+{
+	const auto completed = std::make_shared<std::promise<void>>();
+
+	Enqueue(Command::Exit, nullptr, 0, [completed](const std::vector<BYTE>&, const std::exception_ptr& error)
+	{
+		if (error != nullptr)
+			completed->set_exception(error);
+		else
+			completed->set_value();
+	});
+	return completed->get_future();
+}
+
+std::future<HookReloadReport> PipeClient::ReloadHook()
+{
+	const auto reloaded = std::make_shared<std::promise<HookReloadReport>>();
+
+	Enqueue(Command::ReloadHook, nullptr, 0, [reloaded](const std::vector<BYTE>& reply, const std::exception_ptr& error)
+	{
+		if (error != nullptr)
+			reloaded->set_exception(error);
+		else if (reply.size() < sizeof(int) + sizeof(HookReloadReport))
+			reloaded->set_exception(std::make_exception_ptr(error_code_exception("Incorrect reply.", -1)));
+		else
+			reloaded->set_value(*reinterpret_cast<const HookReloadReport*>(reply.data() + sizeof(int)));
+	});
+	return reloaded->get_future();
+}
+
+std::future<std::vector<BYTE>> PipeClient::QueryUsage()
+{
+	return Request(Command::QueryUsage, nullptr, 0);
+}
+
+std::future<std::vector<BYTE>> PipeClient::Request(const Command command, const void* args, const int len)
+{
+	const auto replied = std::make_shared<std::promise<std::vector<BYTE>>>();
+
+	Enqueue(command, args, len, [replied](const std::vector<BYTE>& reply, const std::exception_ptr& error)
+	{
+		if (error != nullptr)
+			replied->set_exception(error);
+		else
+			replied->set_value(reply);
+	});
+	return replied->get_future();
+}
+
+void PipeClient::setOnLayoutChangedCallback(const std::function<void(UINT)>& callback)
+{
+	_onLayoutChangedCallback = callback;
+}
+
+void PipeClient::setOnHookReloadedCallback(const std::function<void(const HookReloadReport&)>& callback)
+{
+	_onHookReloadedCallback = callback;
+}
+
+void PipeClient::setOnErrorCallback(const std::function<void(int, const std::string&)>& callback)
+{
+	_onErrorCallback = callback;
+}
+
+void PipeClient::setOnConnectionChangedCallback(const std::function<void(bool)>& callback)
+{
+	_onConnectionChangedCallback = callback;
+}
+
+bool PipeClient::IsConnected() const
+{
+	std::lock_guard guard(_lock);
+	return _isConnected;
+}
+
+PipeClientStatistics PipeClient::getStatistics() const
+{
+	std::lock_guard guard(_lock);
+
+	auto statistics = _statistics;
+	if (statistics.FramesSent != 0)
+		statistics.MeanSendLatencyUs = _sendLatencyTotalUs / static_cast<double>(statistics.FramesSent);
+	if (statistics.RepliesReceived != 0)
+		statistics.MeanReplyLatencyUs = _replyLatencyTotalUs / static_cast<double>(statistics.RepliesReceived);
+	return statistics;
+}
+
+// Frame header, tagged command, request id, then the arguments.
+void PipeClient::Enqueue(const Command command, const void* args, const int len, ReplyHandler onReply)
+{
+	OutgoingFrame frame;
+	const int payloadLen = static_cast<int>(sizeof(int)) * 2 + len;
+	const int taggedCommand = command | RequestIdFlag;
+
+	frame.Buffer.resize(FrameHeaderSize + payloadLen);
+	memcpy(frame.Buffer.data(), &payloadLen, sizeof(int));
+	memcpy(frame.Buffer.data() + FrameHeaderSize, &taggedCommand, sizeof(int));
+	if (len > 0)
+		memcpy(frame.Buffer.data() + FrameHeaderSize + sizeof(int) * 2, args, len);
+
+	frame.OnReply = std::move(onReply);
+	QueryPerformanceCounter(&frame.QueuedAt);
+
+	{
+		std::lock_guard guard(_lock);
+		// Positive and unique among the requests that can be outstanding.
+		frame.RequestId = static_cast<int>(++_lastRequestId & 0x7FFFFFFF);
+		memcpy(frame.Buffer.data() + FrameHeaderSize + sizeof(int), &frame.RequestId, sizeof(int));
+		_outgoing.push_back(std::move(frame));
+	}
+	_queueChanged.notify_one();
+}
+
+// Blocks until the server pipe is opened or the client is stopping,
+// backing off exponentially between attempts.
+bool PipeClient::Connect()
+{
+	auto retryDelay = ReconnectMinDelay;
+
+	while (true)
+	{
+		const auto pipe = CreateFile(
+			_pipeName.c_str(),
+			GENERIC_READ | GENERIC_WRITE,
+			0,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_FLAG_OVERLAPPED,
+			nullptr);
+
+		if (pipe != INVALID_HANDLE_VALUE)
+		{
+			DWORD mode = PIPE_READMODE_MESSAGE;
+			SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
+
+			{
+				std::lock_guard guard(_lock);
+				if (_hasConnected)
+					_statistics.Reconnects++;
+				_pipe = pipe;
+				_isConnected = true;
+				_hasConnected = true;
+			}
+			_queueChanged.notify_all();
+
+			if (_onConnectionChangedCallback != nullptr)
+				_onConnectionChangedCallback(true);
+			return true;
+		}
+
+		// All instances busy: wait for one to free up instead of sleeping blindly.
+		if (GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipe(_pipeName.c_str(), retryDelay))
+			continue;
+
+		if (WaitForSingleObject(_stopEvent, retryDelay) == WAIT_OBJECT_0)
+			return false;
+
+		retryDelay = (std::min)(retryDelay * 2, ReconnectMaxDelay);
+	}
+}
+
+void PipeClient::OnConnectionLost()
+{
+	{
+		std::lock_guard guard(_lock);
+		_isConnected = false;
+	}
+
+	// Unblock a write in flight, then wait until the writer has let go of the handle.
+	CancelIoEx(_pipe, nullptr);
+
+	std::deque<PendingReply> lostReplies;
+	{
+		std::lock_guard writeGuard(_writeLock);
+		std::lock_guard guard(_lock);
+		CloseHandle(_pipe);
+		_pipe = INVALID_HANDLE_VALUE;
+		lostReplies.swap(_pendingReplies);
+	}
+
+	// Replies to requests already sent are gone with the connection;
+	// frames still queued are sent after reconnecting.
+	const auto connectionLost = std::make_exception_ptr(error_code_exception("Connection lost.", ERROR_BROKEN_PIPE));
+	for (const auto& pending : lostReplies)
+		pending.OnReply({}, connectionLost);
+
+	if (_onConnectionChangedCallback != nullptr)
+		_onConnectionChangedCallback(false);
+}
+
+bool PipeClient::WaitForIo(HANDLE pipe, OVERLAPPED& overlap, DWORD& transferred) const
+{
+	const HANDLE events[] = { overlap.hEvent, _stopEvent };
+
+	if (WaitForMultipleObjects(2, events, false, INFINITE) != WAIT_OBJECT_0)
+	{
+		CancelIoEx(pipe, &overlap);
+		GetOverlappedResult(pipe, &overlap, &transferred, true);
+		SetLastError(ERROR_OPERATION_ABORTED);
+		return false;
+	}
+
+	return GetOverlappedResult(pipe, &overlap, &transferred, false);
+}
+
+bool PipeClient::ReadMessage(std::vector<BYTE>& message) const
+{
+	OVERLAPPED overlap{};
+	overlap.hEvent = _readEvent;
+	DWORD received = 0;
+
+	message.resize(ReadChunkSize);
+
+	while (true)
+	{
+		DWORD read = 0;
+		ResetEvent(_readEvent);
+
+		const auto isStarted = ReadFile(
+			_pipe,
+			message.data() + received,
+			static_cast<DWORD>(message.size()) - received,
+			nullptr,
+			&overlap);
+
+		if (!isStarted && GetLastError() != ERROR_IO_PENDING && GetLastError() != ERROR_MORE_DATA)
+			return false;
+
+		// The event is signaled on immediate completion too, so one path serves both cases.
+		if (WaitForIo(_pipe, overlap, read))
+		{
+			message.resize(received + read);
+			return true;
+		}
+
+		// Message-mode pipe: the rest of a large frame is fetched by the next read.
+		if (GetLastError() != ERROR_MORE_DATA)
+			return false;
+
+		received += read;
+		message.resize(message.size() * 2);
+	}
+}
+
+bool PipeClient::WriteMessage(HANDLE pipe, const std::vector<BYTE>& message) const
+{
+	OVERLAPPED overlap{};
+	overlap.hEvent = _writeEvent;
+	DWORD written = 0;
+
+	ResetEvent(_writeEvent);
+
+	const auto isStarted = WriteFile(
+		pipe,
+		message.data(),
+		static_cast<DWORD>(message.size()),
+		nullptr,
+		&overlap);
+
+	if (!isStarted && GetLastError() != ERROR_IO_PENDING)
+		return false;
+
+	return WaitForIo(pipe, overlap, written) && written == message.size();
+}
+
+void PipeClient::OnMessage(const std::vector<BYTE>& message)
+{
+	if (message.size() < FrameHeaderSize + sizeof(int))
+		return;
+
+	const auto payload = message.data() + FrameHeaderSize;
+	const auto payloadLen = message.size() - FrameHeaderSize;
+	const auto response = *reinterpret_cast<const int*>(payload);
+
+	{
+		std::lock_guard guard(_lock);
+		_statistics.FramesReceived++;
+	}
+
+	if ((response & RequestIdFlag) == 0)
+	{
+		OnEvent(response, payload + sizeof(int), payloadLen - sizeof(int));
+		return;
+	}
+
+	if (payloadLen < sizeof(int) * 2)
+		return;
+
+	// The reply as an untagged response: Response int, then what follows the request id.
+	const auto requestId = *reinterpret_cast<const int*>(payload + sizeof(int));
+	std::vector<BYTE> reply(payloadLen - sizeof(int));
+	const auto untagged = response & ~RequestIdFlag;
+	memcpy(reply.data(), &untagged, sizeof(int));
+	memcpy(reply.data() + sizeof(int), payload + sizeof(int) * 2, payloadLen - sizeof(int) * 2);
+
+	OnReply(requestId, reply);
+}
+
+// Events, and errors that answer no request, can arrive between a request and its reply.
+void PipeClient::OnEvent(const int response, const BYTE* args, const size_t len) const
+{
+	switch (response)
+	{
+	case Response::LayoutChanged:
+		if (len >= sizeof(UINT) && _onLayoutChangedCallback != nullptr)
+			_onLayoutChangedCallback(*reinterpret_cast<const UINT*>(args));
+		break;
+	case Response::HookReloaded:
+		if (len >= sizeof(HookReloadReport) && _onHookReloadedCallback != nullptr)
+			_onHookReloadedCallback(*reinterpret_cast<const HookReloadReport*>(args));
+		break;
+	case Response::Error:
+		if (_onErrorCallback != nullptr)
+		{
+			const auto code = len >= sizeof(int) ? *reinterpret_cast<const int*>(args) : -1;
+			const auto text = len > sizeof(int) ? std::string(reinterpret_cast<const char*>(args + sizeof(int))) : std::string();
+			_onErrorCallback(code, text);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void PipeClient::OnReply(const int requestId, std::vector<BYTE>& reply)
+{
+	ReplyHandler onReply;
+	{
+		std::lock_guard guard(_lock);
+
+		// Usually the oldest one, the server answers in order.
+		const auto pending = std::find_if(_pendingReplies.begin(), _pendingReplies.end(),
+			[requestId](const PendingReply& entry) { return entry.RequestId == requestId; });
+
+		// Already failed with its connection.
+		if (pending == _pendingReplies.end())
+			return;
+
+		onReply = std::move(pending->OnReply);
+		_statistics.RepliesReceived++;
+		_replyLatencyTotalUs += ElapsedUs(pending->WrittenAt);
+		_pendingReplies.erase(pending);
+	}
+
+	if (*reinterpret_cast<const int*>(reply.data()) != Response::Error)
+	{
+		onReply(reply, nullptr);
+		return;
+	}
+
+	const auto code = reply.size() >= sizeof(int) * 2 ? *reinterpret_cast<const int*>(reply.data() + sizeof(int)) : -1;
+	const auto text = reply.size() > sizeof(int) * 2
+		? std::string(reinterpret_cast<const char*>(reply.data() + sizeof(int) * 2))
+		: std::string();
+	onReply({}, std::make_exception_ptr(error_code_exception(text.c_str(), code)));
+}
+
+void PipeClient::ReaderTask()
+{
+	std::vector<BYTE> message;
+
+	while (WaitForSingleObject(_stopEvent, 0) != WAIT_OBJECT_0)
+	{
+		if (!Connect())
+			break;
+
+		while (ReadMessage(message))
+			OnMessage(message);
+
+		OnConnectionLost();
+	}
+}
+
+void PipeClient::WriterTask()
+{
+	auto retryDelay = WriteRetryMinDelay;
+
+	while (true)
+	{
+		{
+			std::unique_lock guard(_lock);
+			_queueChanged.wait(guard, [this]
+			{
+				return _isStopping || (_isConnected && !_outgoing.empty());
+			});
+
+			if (_isStopping)
+				break;
+		}
+
+		// Lock order is write lock, then state lock, same as OnConnectionLost.
+		std::unique_lock writeGuard(_writeLock);
+
+		OutgoingFrame frame;
+		HANDLE pipe;
+		{
+			std::lock_guard guard(_lock);
+			if (!_isConnected || _outgoing.empty())
+				continue;
+
+			frame = std::move(_outgoing.front());
+			_outgoing.pop_front();
+			pipe = _pipe;
+
+			// Registered before the write so a fast reply always finds its request.
+			PendingReply pending;
+			pending.RequestId = frame.RequestId;
+			QueryPerformanceCounter(&pending.WrittenAt);
+			pending.OnReply = std::move(frame.OnReply);
+			_pendingReplies.push_back(std::move(pending));
+		}
+
+		if (!WriteMessage(pipe, frame.Buffer))
+		{
+			{
+				std::lock_guard guard(_lock);
+				const auto pending = std::find_if(_pendingReplies.begin(), _pendingReplies.end(),
+					[&frame](const PendingReply& entry) { return entry.RequestId == frame.RequestId; });
+
+				// Not sent, so it goes back to the queue, unless it has already failed with the connection.
+				if (pending != _pendingReplies.end())
+				{
+					frame.OnReply = std::move(pending->OnReply);
+					_pendingReplies.erase(pending);
+					_outgoing.push_front(std::move(frame));
+				}
+			}
+
+			// A pipe that keeps failing without breaking must not keep this thread spinning.
+			writeGuard.unlock();
+			WaitForSingleObject(_stopEvent, retryDelay);
+			retryDelay = (std::min)(retryDelay * 2, WriteRetryMaxDelay);
+			continue;
+		}
+
+		retryDelay = WriteRetryMinDelay;
+
+		const auto latencyUs = ElapsedUs(frame.QueuedAt);
+		{
+			std::lock_guard guard(_lock);
+			_statistics.FramesSent++;
+			_sendLatencyTotalUs += latencyUs;
+			_statistics.MaxSendLatencyUs = (std::max)(_statistics.MaxSendLatencyUs, latencyUs);
+		}
+	}
+}
+
+double PipeClient::ElapsedUs(const LARGE_INTEGER& since) const
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return static_cast<double>(now.QuadPart - since.QuadPart) * 1000000.0 / static_cast<double>(_frequency.QuadPart);
+}
+
+PipeClient::~PipeClient()
+{
+	SetEvent(_stopEvent);
+	{
+		std::lock_guard guard(_lock);
+		_isStopping = true;
+	}
+	_queueChanged.notify_all();
+
+	if (_writerThread.joinable())
+		_writerThread.join();
+	if (_readerThread.joinable())
+		_readerThread.join();
+
+	CloseHandle(_writeEvent);
+	CloseHandle(_readEvent);
+	CloseHandle(_stopEvent);
+}
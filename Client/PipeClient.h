@@ -0,0 +1,127 @@
+﻿#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Windows.h>
+
+#include "../Protocol.h"
+
+// ReSharper disable CppInconsistentNaming
+
+struct PipeClientStatistics
+{
+	UINT64 FramesSent;
+	UINT64 FramesReceived;
+	UINT64 RepliesReceived;
+	UINT64 Reconnects;
+	double MeanSendLatencyUs;	// from the API call to the completed write
+	double MaxSendLatencyUs;
+	double MeanReplyLatencyUs;	// from the completed write to the matching reply
+};
+
+// See HookSwapReport on the server.
+struct HookReloadReport
+{
+	int GapUs;
+	int LostRequests;		// buffered requests dropped for lack of a backend
+	int DuplicateEvents;
+	int BufferedRequests;
+};
+
+// Asynchronous client of PipeServer.
+// Calls only queue a frame and return a future, so any number of requests can be
+// outstanding at once. Every request carries an id the server echoes in its one reply,
+// see RequestIdFlag, so errors nobody asked for cannot be taken for a reply. Events and
+// replies are delivered from one reader thread, which also reconnects on its own when
+// the pipe breaks; queued frames survive it. Set the callbacks, then Start.
+class PipeClient
+{
+public:
+	explicit PipeClient(const std::wstring& pipeName = ServerPipeName);
+	PipeClient(const PipeClient &pc) = delete;
+	~PipeClient();
+
+	void Start();
+
+	// Complete once the server has handled the command.
+	std::future<void> ChangeLayout(HWND hWnd, int klId, int hkl);
+	std::future<void> Exit();
+	// Reloads triggered by the server itself arrive through the hook reloaded callback instead.
+	std::future<HookReloadReport> ReloadHook();
+	// Reply is UsageSnapshot followed by the records declared in Protocol.h.
+	std::future<std::vector<BYTE>> QueryUsage();
+	// The reply is the response payload, Response int included and request id left out.
+	std::future<std::vector<BYTE>> Request(Command command, const void* args, int len);
+
+	void setOnLayoutChangedCallback(const std::function<void(UINT)>& callback);
+	void setOnHookReloadedCallback(const std::function<void(const HookReloadReport&)>& callback);
+	void setOnErrorCallback(const std::function<void(int, const std::string&)>& callback);
+	void setOnConnectionChangedCallback(const std::function<void(bool)>& callback);
+	bool IsConnected() const;
+	PipeClientStatistics getStatistics() const;
+
+private:
+	// Called once, with the reply or with the exception that ended the request.
+	typedef std::function<void(const std::vector<BYTE>&, const std::exception_ptr&)> ReplyHandler;
+
+	struct OutgoingFrame
+	{
+		std::vector<BYTE> Buffer;
+		int RequestId;
+		LARGE_INTEGER QueuedAt;
+		ReplyHandler OnReply;
+	};
+
+	struct PendingReply
+	{
+		int RequestId;
+		LARGE_INTEGER WrittenAt;
+		ReplyHandler OnReply;
+	};
+
+	std::wstring _pipeName;
+	HANDLE _pipe;
+	HANDLE _stopEvent;
+	HANDLE _readEvent;
+	HANDLE _writeEvent;
+	bool _isConnected;
+	bool _isStopping;
+	bool _hasConnected;
+	UINT _lastRequestId;
+
+	mutable std::mutex _lock;
+	std::condition_variable _queueChanged;
+	std::deque<OutgoingFrame> _outgoing;
+	std::deque<PendingReply> _pendingReplies;
+	std::mutex _writeLock;
+
+	std::thread _readerThread;
+	std::thread _writerThread;
+	std::function<void(UINT)> _onLayoutChangedCallback;
+	std::function<void(const HookReloadReport&)> _onHookReloadedCallback;
+	std::function<void(int, const std::string&)> _onErrorCallback;
+	std::function<void(bool)> _onConnectionChangedCallback;
+
+	LARGE_INTEGER _frequency;
+	PipeClientStatistics _statistics;
+	double _sendLatencyTotalUs;
+	double _replyLatencyTotalUs;
+
+	void Enqueue(Command command, const void* args, int len, ReplyHandler onReply);
+	bool Connect();
+	void OnConnectionLost();
+	bool WaitForIo(HANDLE pipe, OVERLAPPED& overlap, DWORD& transferred) const;
+	bool ReadMessage(std::vector<BYTE>& message) const;
+	bool WriteMessage(HANDLE pipe, const std::vector<BYTE>& message) const;
+	void OnMessage(const std::vector<BYTE>& message);
+	void OnEvent(int response, const BYTE* args, size_t len) const;
+	void OnReply(int requestId, std::vector<BYTE>& reply);
+	void ReaderTask();
+	void WriterTask();
+	double ElapsedUs(const LARGE_INTEGER& since) const;
+};
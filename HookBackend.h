@@ -0,0 +1,23 @@
+﻿#pragma once
+#include <Windows.h>
+
+enum class HookArchitecture
+{
+	X86,
+	X64,
+};
+
+// Layout change requests are sent to the target window from the pipe thread, a window that
+// does not answer in time is given up on rather than left holding the server.
+constexpr UINT ChangeLayoutRequestTimeout = 250;
+
+// Single hook library seen by the server. HookControl is the real one,
+// anything else implementing this can stand in for it.
+class HookBackend
+{
+public:
+	virtual ~HookBackend() = default;
+	virtual HookArchitecture getArchitecture() const = 0;
+	virtual UINT getLayoutChangedMessageCode() const = 0;
+	virtual void ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const = 0;
+};
@@ -8,10 +8,11 @@ const auto GetLayoutChangedMessageCodeProcName = "GetLayoutChangedMessageCode";
 const auto GetLayoutChangeRequestMessageCodeProcName = "GetLayoutChangeRequestMessageCode";
 const auto DestroyLangHookProcName = "DestroyLangHook";
 
-HookControl::HookControl(const std::wstring& hookLibName, HWND messageWindow)
+HookControl::HookControl(const std::wstring& hookLibName, const HookArchitecture architecture, HWND messageWindow)
+	: _architecture{architecture}
 {
 	_hookLibHandle = LoadLibrary(hookLibName.c_str());
-	if (_hookLibHandle == INVALID_HANDLE_VALUE)
+	if (_hookLibHandle == nullptr)
 		throw error_code_exception("Error loading hook dll.", static_cast<int>(GetLastError()));
 
 	const auto getLayoutChangedMessageCodeProc = reinterpret_cast<GetMsgCodeProc>
@@ -26,17 +27,30 @@ HookControl::HookControl(const std::wstring& hookLibName, HWND messageWindow)
 	_destroyLangHookProc = reinterpret_cast<DestroyHookProc>
 		(GetProcAddress(_hookLibHandle,  DestroyLangHookProcName));
 
+	if (getLayoutChangedMessageCodeProc == nullptr || getLayoutChangeRequestMessageCodeProc == nullptr
+		|| setLangHookProc == nullptr || _destroyLangHookProc == nullptr)
+	{
+		const auto error = GetLastError();
+		FreeLibrary(_hookLibHandle);
+		throw error_code_exception("Hook dll export not found.", static_cast<int>(error));
+	}
+
 	_layoutChangedMessageCode = getLayoutChangedMessageCodeProc();
 	_layoutChangeRequestMessageCode = getLayoutChangeRequestMessageCodeProc();
 
 	_hook = setLangHookProc(messageWindow);
 	if (_hook == nullptr)
-		throw error_code_exception("Error installing hook.", static_cast<int>(GetLastError()));
+	{
+		const auto error = GetLastError();
+		FreeLibrary(_hookLibHandle);
+		throw error_code_exception("Error installing hook.", static_cast<int>(error));
+	}
 }
 
 void HookControl::ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const
 {
-	SendMessage(hWnd, _layoutChangeRequestMessageCode, klId, hkl);
+	SendMessageTimeout(hWnd, _layoutChangeRequestMessageCode, klId, hkl,
+		SMTO_ABORTIFHUNG, ChangeLayoutRequestTimeout, nullptr);
 }
 
 UINT HookControl::getLayoutChangedMessageCode() const
@@ -44,8 +58,20 @@ UINT HookControl::getLayoutChangedMessageCode() const
 	return _layoutChangedMessageCode;
 }
 
+UINT HookControl::getLayoutChangeRequestMessageCode() const
+{
+	return _layoutChangeRequestMessageCode;
+}
+
+HookArchitecture HookControl::getArchitecture() const
+{
+	return _architecture;
+}
+
+// The library releases the hook along with whatever it keeps for it; unhooked here only if it fails to.
 HookControl::~HookControl()
 {
-	UnhookWindowsHookEx(_hook);
+	if (!_destroyLangHookProc())
+		UnhookWindowsHookEx(_hook);
 	FreeLibrary(_hookLibHandle);
 }
\ No newline at end of file
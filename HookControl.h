@@ -2,20 +2,25 @@
 #include <string>
 #include <Windows.h>
 
-class HookControl
+#include "HookBackend.h"
+
+class HookControl final : public HookBackend
 {
 public:
-	HookControl(const std::wstring& hookLibName, HWND messageWindow);
-	~HookControl();
+	HookControl(const std::wstring& hookLibName, HookArchitecture architecture, HWND messageWindow);
+	~HookControl() override;
 	HookControl(const HookControl &hc) = delete;
-	void ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const;
-	UINT getLayoutChangedMessageCode() const;
+	void ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const override;
+	UINT getLayoutChangedMessageCode() const override;
+	UINT getLayoutChangeRequestMessageCode() const;
+	HookArchitecture getArchitecture() const override;
 
 private:
 	typedef HHOOK (*SetLangHookProc)(HWND);
 	typedef UINT (*GetMsgCodeProc)();
 	typedef bool (*DestroyHookProc)();
 		
+	HookArchitecture _architecture;
 	UINT _layoutChangedMessageCode;
 	UINT _layoutChangeRequestMessageCode;
 	HHOOK _hook;
@@ -0,0 +1,79 @@
+// ReSharper disable CppInconsistentNaming
+#include <memory>
+#include <string>
+#include <Windows.h>
+#include <shellapi.h>
+
+#include "../error_code_exception.h"
+#include "../HookControl.h"
+#include "../HookHostBackend.h"
+
+// Anonymous pipes cannot be waited on, the standard input is polled between messages.
+constexpr DWORD InputPollInterval = 100;
+
+// Installs a hook library for a server of the other bitness, see HookHostBackend.
+// Usage: NativeLangHookHost_<arch> <hook library path> <message window handle>
+// Reports the outcome on the standard output, then keeps the hook installed and pumps
+// the messages it is called back with until the server closes the standard input or goes away.
+int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow)
+{
+	const auto input = GetStdHandle(STD_INPUT_HANDLE);
+	const auto output = GetStdHandle(STD_OUTPUT_HANDLE);
+
+	int argc;
+	const auto argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (argv == nullptr || argc < 3)
+		return 1;
+
+	const std::wstring hookLibPath = argv[1];
+	const auto messageWindow = reinterpret_cast<HWND>(static_cast<UINT_PTR>(wcstoull(argv[2], nullptr, 10)));  // NOLINT(performance-no-int-to-ptr)
+	LocalFree(argv);
+
+#ifdef _WIN64
+	constexpr auto architecture = HookArchitecture::X64;
+#else
+	constexpr auto architecture = HookArchitecture::X86;
+#endif
+
+	HookHostHandshake handshake{};
+	std::unique_ptr<HookControl> hook;
+	try
+	{
+		hook = std::make_unique<HookControl>(hookLibPath, architecture, messageWindow);
+		handshake.LayoutChangedMessageCode = hook->getLayoutChangedMessageCode();
+		handshake.LayoutChangeRequestMessageCode = hook->getLayoutChangeRequestMessageCode();
+	}
+	catch (error_code_exception& error)
+	{
+		handshake.ErrorCode = error.Code() != 0 ? error.Code() : -1;
+	}
+
+	DWORD transferred;
+	WriteFile(output, &handshake, sizeof handshake, &transferred, nullptr);
+	if (hook == nullptr)
+		return 1;
+
+	// Nothing is ever sent, peeking fails once the server closed its end.
+	MSG msg;
+	auto isRunning = true;
+	while (isRunning)
+	{
+		MsgWaitForMultipleObjects(0, nullptr, false, InputPollInterval, QS_ALLINPUT);
+
+		while (isRunning && PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+		{
+			if (msg.message == WM_QUIT)
+			{
+				isRunning = false;
+				break;
+			}
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
+
+		if (!PeekNamedPipe(input, nullptr, 0, nullptr, nullptr, nullptr))
+			isRunning = false;
+	}
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+// ReSharper disable CppInconsistentNaming
+#include "HookHostBackend.h"
+
+#include "error_code_exception.h"
+
+constexpr DWORD HostStartTimeout = 5000;
+constexpr DWORD HostExitTimeout = 1000;
+constexpr DWORD HandshakePollInterval = 10;
+constexpr UINT HostTerminatedExitCode = 1;
+
+HookHostBackend::HookHostBackend(const std::wstring& hostPath, const std::wstring& hookLibPath,
+	const HookArchitecture architecture, HWND messageWindow)
+	: _architecture{architecture}, _layoutChangedMessageCode{0}, _layoutChangeRequestMessageCode{0}
+{
+	SECURITY_ATTRIBUTES inheritable{ sizeof(SECURITY_ATTRIBUTES), nullptr, true };
+	HANDLE inputRead, inputWrite, outputRead, outputWrite;
+
+	if (!CreatePipe(&inputRead, &inputWrite, &inheritable, 0))
+		throw error_code_exception("Error creating hook host pipe.", static_cast<int>(GetLastError()));
+
+	if (!CreatePipe(&outputRead, &outputWrite, &inheritable, 0))
+	{
+		const auto error = GetLastError();
+		CloseHandle(inputRead);
+		CloseHandle(inputWrite);
+		throw error_code_exception("Error creating hook host pipe.", static_cast<int>(error));
+	}
+
+	// Only the host ends are inherited.
+	SetHandleInformation(inputWrite, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(outputRead, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFO startupInfo{};
+	startupInfo.cb = sizeof startupInfo;
+	startupInfo.dwFlags = STARTF_USESTDHANDLES;
+	startupInfo.hStdInput = inputRead;
+	startupInfo.hStdOutput = outputWrite;
+	startupInfo.hStdError = outputWrite;
+
+	auto commandLine = L"\"" + hostPath + L"\" \"" + hookLibPath + L"\" "
+		+ std::to_wstring(reinterpret_cast<UINT_PTR>(messageWindow));
+
+	PROCESS_INFORMATION processInfo;
+	const auto isStarted = CreateProcess(hostPath.c_str(), commandLine.data(), nullptr, nullptr,
+		true, CREATE_NO_WINDOW, nullptr, nullptr, &startupInfo, &processInfo);
+	const auto startError = GetLastError();
+
+	// The host has its own copies; ours would keep the pipes open after it is gone.
+	CloseHandle(inputRead);
+	CloseHandle(outputWrite);
+
+	if (!isStarted)
+	{
+		CloseHandle(inputWrite);
+		CloseHandle(outputRead);
+		throw error_code_exception("Error starting hook host.", static_cast<int>(startError));
+	}
+
+	CloseHandle(processInfo.hThread);
+	_process = processInfo.hProcess;
+	_hostInput = inputWrite;
+
+	HookHostHandshake handshake{};
+	const auto isReady = ReadHandshake(outputRead, handshake);
+	CloseHandle(outputRead);
+
+	if (!isReady || handshake.ErrorCode != 0)
+	{
+		StopHost();
+		throw error_code_exception("Error installing hook in hook host.", isReady ? handshake.ErrorCode : -1);
+	}
+
+	_layoutChangedMessageCode = handshake.LayoutChangedMessageCode;
+	_layoutChangeRequestMessageCode = handshake.LayoutChangeRequestMessageCode;
+}
+
+// Anonymous pipes have no overlapped reads, so the handshake is polled to bound the wait.
+bool HookHostBackend::ReadHandshake(HANDLE hostOutput, HookHostHandshake& handshake) const
+{
+	const auto deadline = GetTickCount64() + HostStartTimeout;
+
+	while (GetTickCount64() < deadline)
+	{
+		// Fails once the host is gone and everything it wrote has been read.
+		DWORD available = 0;
+		if (!PeekNamedPipe(hostOutput, nullptr, 0, nullptr, &available, nullptr))
+			return false;
+
+		if (available >= sizeof handshake)
+		{
+			DWORD read = 0;
+			return ReadFile(hostOutput, &handshake, sizeof handshake, &read, nullptr) && read == sizeof handshake;
+		}
+
+		WaitForSingleObject(_process, HandshakePollInterval);
+	}
+
+	return false;
+}
+
+void HookHostBackend::ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const
+{
+	SendMessageTimeout(hWnd, _layoutChangeRequestMessageCode, klId, hkl,
+		SMTO_ABORTIFHUNG, ChangeLayoutRequestTimeout, nullptr);
+}
+
+UINT HookHostBackend::getLayoutChangedMessageCode() const
+{
+	return _layoutChangedMessageCode;
+}
+
+HookArchitecture HookHostBackend::getArchitecture() const
+{
+	return _architecture;
+}
+
+std::wstring HookHostBackend::getHostFileName(const HookArchitecture architecture)
+{
+	return architecture == HookArchitecture::X86
+		? L"NativeLangHookHost_x86.exe"
+		: L"NativeLangHookHost_x64.exe";
+}
+
+// The host unhooks and exits once its input is closed. A host that does not is terminated,
+// the system removes its hook then.
+void HookHostBackend::StopHost() const
+{
+	CloseHandle(_hostInput);
+
+	if (WaitForSingleObject(_process, HostExitTimeout) != WAIT_OBJECT_0)
+		TerminateProcess(_process, HostTerminatedExitCode);
+
+	CloseHandle(_process);
+}
+
+HookHostBackend::~HookHostBackend()
+{
+	StopHost();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <Windows.h>
+
+#include "HookBackend.h"
+
+// Written by the host to its standard output once the hook is installed, or has failed to.
+struct HookHostHandshake
+{
+	int ErrorCode;	// 0 when the hook is installed
+	UINT LayoutChangedMessageCode;
+	UINT LayoutChangeRequestMessageCode;
+};
+
+// Hook library of the other bitness. A process can only map libraries of its own bitness,
+// so the hook is installed by a helper process (NativeLangHookHost_x86/_x64) next to the server.
+// Window handles and registered messages are shared by the session: the hook reports straight
+// to the message window of this process and requests are sent straight to the target windows,
+// the host only keeps the hook installed until its standard input is closed.
+class HookHostBackend final : public HookBackend
+{
+public:
+	HookHostBackend(const std::wstring& hostPath, const std::wstring& hookLibPath, HookArchitecture architecture, HWND messageWindow);
+	~HookHostBackend() override;
+	HookHostBackend(const HookHostBackend &hb) = delete;
+	void ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const override;
+	UINT getLayoutChangedMessageCode() const override;
+	HookArchitecture getArchitecture() const override;
+
+	static std::wstring getHostFileName(HookArchitecture architecture);
+
+private:
+	HookArchitecture _architecture;
+	UINT _layoutChangedMessageCode;
+	UINT _layoutChangeRequestMessageCode;
+	HANDLE _process;
+	HANDLE _hostInput;
+
+	bool ReadHandshake(HANDLE hostOutput, HookHostHandshake& handshake) const;
+	void StopHost() const;
+};
@@ -0,0 +1,226 @@
+﻿// ReSharper disable CppInconsistentNaming
+#include "HookMultiplexer.h"
+
+#include <algorithm>
+
+// Old and new hooks report the same switch within this interval while both are installed.
+constexpr UINT64 DuplicateWindowMs = 100;
+constexpr size_t MaxRetiredMessageCodes = 8;
+
+HookMultiplexer::HookMultiplexer(ArchitectureResolver resolver)
+	: _resolver{std::move(resolver)}, _sequence{0}, _isSwapping{false}, _swapStartedAt{},
+	_dedupeUntil{0}, _lastEventAt{0}, _lastLayout{0}, _swapReport{}
+{ }
+
+void HookMultiplexer::AddBackend(std::unique_ptr<HookBackend> backend)
+{
+	std::lock_guard guard(_lock);
+	_backends.push_back(std::move(backend));
+}
+
+void HookMultiplexer::RemoveBackend(const HookBackend* backend)
+{
+	std::shared_ptr<HookBackend> removed;
+	{
+		std::lock_guard guard(_lock);
+
+		const auto it = std::find_if(_backends.begin(), _backends.end(),
+			[backend](const std::shared_ptr<HookBackend>& item) { return item.get() == backend; });
+		if (it == _backends.end())
+			return;
+
+		removed = std::move(*it);
+		_backends.erase(it);
+
+		const auto code = removed->getLayoutChangedMessageCode();
+		if (std::find(_retiredMessageCodes.begin(), _retiredMessageCodes.end(), code) == _retiredMessageCodes.end())
+		{
+			if (_retiredMessageCodes.size() == MaxRetiredMessageCodes)
+				_retiredMessageCodes.erase(_retiredMessageCodes.begin());
+			_retiredMessageCodes.push_back(code);
+		}
+	}
+
+	// Unhooking happens here, outside the lock, unless a request still holds the backend.
+	removed.reset();
+}
+
+size_t HookMultiplexer::getBackendCount() const
+{
+	std::lock_guard guard(_lock);
+	return _backends.size();
+}
+
+bool HookMultiplexer::TryTranslateMessage(const UINT uMsg, const LPARAM lParam, LayoutChangedEvent& event)
+{
+	std::lock_guard guard(_lock);
+	const auto now = GetTickCount64();
+	const auto layout = static_cast<UINT>(lParam);
+
+	auto backendIndex = RetiredBackendIndex;
+	for (size_t i = 0; i < _backends.size(); i++)
+	{
+		if (_backends[i]->getLayoutChangedMessageCode() == uMsg)
+		{
+			backendIndex = i;
+			break;
+		}
+	}
+
+	if (backendIndex == RetiredBackendIndex
+		&& std::find(_retiredMessageCodes.begin(), _retiredMessageCodes.end(), uMsg) == _retiredMessageCodes.end())
+		return false;
+
+	if (IsDuplicate(layout, now))
+	{
+		_swapReport.DuplicateEvents++;
+		return false;
+	}
+
+	event.Sequence = ++_sequence;
+	event.BackendIndex = backendIndex;
+	event.Layout = layout;
+	_lastEventAt = now;
+	_lastLayout = layout;
+	return true;
+}
+
+bool HookMultiplexer::ChangeLayoutRequest(HWND hWnd, const int klId, const int hkl)
+{
+	const auto architecture = _resolver(hWnd);
+	std::shared_ptr<HookBackend> backend;
+	{
+		std::lock_guard guard(_lock);
+
+		if (_isSwapping)
+		{
+			_bufferedRequests.push_back({ hWnd, klId, hkl });
+			return true;
+		}
+
+		backend = SelectBackend(architecture);
+		if (backend == nullptr)
+			return false;
+	}
+
+	// Sent without the lock: the target may notify the message window before it returns.
+	backend->ChangeLayoutRequest(hWnd, klId, hkl);
+	return true;
+}
+
+void HookMultiplexer::BeginSwap()
+{
+	std::lock_guard guard(_lock);
+	_isSwapping = true;
+	_swapReport = {};
+	QueryPerformanceCounter(&_swapStartedAt);
+}
+
+HookSwapReport HookMultiplexer::EndSwap()
+{
+	HookSwapReport report;
+	UINT lostRequests = 0;
+	{
+		std::lock_guard guard(_lock);
+
+		LARGE_INTEGER now, frequency;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&frequency);
+
+		report = _swapReport;
+		report.GapUs = static_cast<UINT64>((now.QuadPart - _swapStartedAt.QuadPart) * 1000000 / frequency.QuadPart);
+		report.BufferedRequests = static_cast<UINT>(_bufferedRequests.size());
+
+		// Notifications of the old hook may still be queued behind the new ones.
+		_dedupeUntil = GetTickCount64() + DuplicateWindowMs;
+	}
+
+	// Requests arriving meanwhile are still buffered, so flushing keeps them in order.
+	while (true)
+	{
+		std::vector<LayoutChangeRequest> requests;
+		{
+			std::lock_guard guard(_lock);
+			if (_bufferedRequests.empty())
+			{
+				_isSwapping = false;
+				break;
+			}
+			requests.swap(_bufferedRequests);
+		}
+
+		for (const auto& request : requests)
+		{
+			const auto architecture = _resolver(request.Window);
+			std::shared_ptr<HookBackend> backend;
+			{
+				std::lock_guard guard(_lock);
+				backend = SelectBackend(architecture);
+			}
+
+			if (backend != nullptr)
+				backend->ChangeLayoutRequest(request.Window, request.KlId, request.Hkl);
+			else
+				lostRequests++;
+		}
+	}
+
+	report.LostRequests = lostRequests;
+	return report;
+}
+
+std::shared_ptr<HookBackend> HookMultiplexer::SelectBackend(const HookArchitecture architecture) const
+{
+	for (const auto& backend : _backends)
+	{
+		if (backend->getArchitecture() == architecture)
+			return backend;
+	}
+
+	// No backend of the window's architecture: the first one is still the best effort,
+	// the request message is delivered to the window regardless of who sends it.
+	return _backends.empty() ? nullptr : _backends.front();
+}
+
+bool HookMultiplexer::IsDuplicate(const UINT layout, const UINT64 now) const
+{
+	return (_isSwapping || now < _dedupeUntil)
+		&& layout == _lastLayout
+		&& now - _lastEventAt <= DuplicateWindowMs;
+}
+
+HookArchitecture HookMultiplexer::getProcessArchitecture()
+{
+#ifdef _WIN64
+	return HookArchitecture::X64;
+#else
+	return HookArchitecture::X86;
+#endif
+}
+
+HookArchitecture HookMultiplexer::ResolveWindowArchitecture(HWND hWnd)
+{
+	DWORD processId = 0;
+	GetWindowThreadProcessId(hWnd, &processId);
+
+	const auto process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, processId);
+	if (process == nullptr)
+		return getProcessArchitecture();
+
+	BOOL isWow64 = false;
+	const auto isSuccess = IsWow64Process(process, &isWow64);
+	CloseHandle(process);
+
+	if (!isSuccess)
+		return getProcessArchitecture();
+
+	if (isWow64)
+		return HookArchitecture::X86;
+
+	// Not under WOW64 means native: native is x64 unless this very process is x86 on an x86 OS.
+	BOOL isSelfWow64 = false;
+	IsWow64Process(GetCurrentProcess(), &isSelfWow64);
+	return getProcessArchitecture() == HookArchitecture::X64 || isSelfWow64
+		? HookArchitecture::X64
+		: HookArchitecture::X86;
+}
@@ -0,0 +1,83 @@
+﻿#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <Windows.h>
+
+#include "HookBackend.h"
+
+// Backend index of a notification posted by a hook removed in a recent swap.
+constexpr size_t RetiredBackendIndex = static_cast<size_t>(-1);
+
+struct LayoutChangedEvent
+{
+	UINT64 Sequence;
+	size_t BackendIndex;
+	UINT Layout;
+};
+
+// The old hook is removed only after the new one is installed, so no switch goes unreported:
+// late notifications of the old hook are still delivered unless the new one already reported
+// the switch. What can get lost is a layout change request buffered during the swap that
+// no backend was left to take when the swap ended.
+struct HookSwapReport
+{
+	UINT64 GapUs;			// time layout change requests were held back
+	UINT LostRequests;		// buffered requests dropped for lack of a backend
+	UINT DuplicateEvents;	// notifications reported by both the old and the new backend
+	UINT BufferedRequests;
+};
+
+// Owns every hook backend of the process. All backends report to the same message window,
+// so their notifications are merged here into one sequence-numbered stream, and layout
+// change requests are routed to the backend matching the target window architecture.
+// Between BeginSwap and EndSwap backends may be replaced: requests are buffered and
+// notifications reported twice by the overlapping old and new hooks are dropped.
+// Message codes of the last few removed backends stay known, for their late notifications,
+// even when the next swap follows right away.
+class HookMultiplexer
+{
+public:
+	typedef std::function<HookArchitecture(HWND)> ArchitectureResolver;
+
+	explicit HookMultiplexer(ArchitectureResolver resolver = ResolveWindowArchitecture);
+	HookMultiplexer(const HookMultiplexer &hm) = delete;
+
+	void AddBackend(std::unique_ptr<HookBackend> backend);
+	void RemoveBackend(const HookBackend* backend);
+	size_t getBackendCount() const;
+	bool TryTranslateMessage(UINT uMsg, LPARAM lParam, LayoutChangedEvent& event);
+	bool ChangeLayoutRequest(HWND hWnd, int klId, int hkl);
+
+	void BeginSwap();
+	HookSwapReport EndSwap();
+
+	static HookArchitecture getProcessArchitecture();
+	static HookArchitecture ResolveWindowArchitecture(HWND hWnd);
+
+private:
+	struct LayoutChangeRequest
+	{
+		HWND Window;
+		int KlId;
+		int Hkl;
+	};
+
+	mutable std::mutex _lock;
+	std::vector<std::shared_ptr<HookBackend>> _backends;
+	ArchitectureResolver _resolver;
+	UINT64 _sequence;
+
+	bool _isSwapping;
+	LARGE_INTEGER _swapStartedAt;
+	UINT64 _dedupeUntil;
+	UINT64 _lastEventAt;
+	UINT _lastLayout;
+	std::vector<UINT> _retiredMessageCodes;
+	std::vector<LayoutChangeRequest> _bufferedRequests;
+	HookSwapReport _swapReport;
+
+	std::shared_ptr<HookBackend> SelectBackend(HookArchitecture architecture) const;
+	bool IsDuplicate(UINT layout, UINT64 now) const;
+};
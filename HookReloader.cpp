@@ -0,0 +1,250 @@
+﻿// ReSharper disable CppInconsistentNaming
+#include "HookReloader.h"
+
+#include "error_code_exception.h"
+#include "HookControl.h"
+#include "HookHostBackend.h"
+
+constexpr auto HookLibExtension = L".dll";
+constexpr auto ShadowExtension = L".shadow.dll";
+constexpr int MaxShadowAttempts = 8;
+constexpr DWORD ChangeSettleDelay = 500;
+
+HookReloader::HookReloader(HookMultiplexer& multiplexer, MessageWindow& messageWindow, const CancellationToken& cancellationToken)
+	: _multiplexer{multiplexer}, _messageWindow{messageWindow}, _cancellationToken{cancellationToken}, _generation{0}
+{
+	wchar_t modulePath[MAX_PATH];
+	const auto len = GetModuleFileName(nullptr, modulePath, MAX_PATH);
+	if (len == 0 || len == MAX_PATH)
+		throw error_code_exception("Error getting module path.", static_cast<int>(GetLastError()));
+
+	_directory = modulePath;
+	_directory.resize(_directory.find_last_of(L'\\') + 1);
+
+	_stopEvent = CreateEvent(nullptr, true, false, nullptr);
+	if (_stopEvent == nullptr)
+		throw error_code_exception("Error creating event.", static_cast<int>(GetLastError()));
+}
+
+void HookReloader::AddLibrary(const std::wstring& name, const HookArchitecture architecture)
+{
+	_libraries.push_back({ name, architecture, _directory + name + HookLibExtension, {}, {}, nullptr });
+}
+
+void HookReloader::setOnReloadedCallback(const std::function<void(const HookSwapReport&)>& callback)
+{
+	_onReloadedCallback = callback;
+}
+
+void HookReloader::setOnReloadFailedCallback(const std::function<void(const char*, int)>& callback)
+{
+	_onReloadFailedCallback = callback;
+}
+
+// Libraries of the other bitness are installed through their hook host. Libraries that fail
+// to install are skipped, loading only fails when no backend at all could be installed.
+void HookReloader::LoadAll()
+{
+	std::lock_guard guard(_reloadLock);
+	auto lastErrorCode = -1;
+
+	for (auto& library : _libraries)
+	{
+		DeleteStaleShadows(library);
+
+		try
+		{
+			Install(library);
+		}
+		catch (error_code_exception& error)
+		{
+			lastErrorCode = error.Code();
+		}
+	}
+
+	if (_multiplexer.getBackendCount() == 0)
+		throw error_code_exception("Error loading hook dll.", lastErrorCode);
+}
+
+// A library whose new version fails to install keeps running the old one.
+HookSwapReport HookReloader::Reload()
+{
+	std::lock_guard guard(_reloadLock);
+	auto reloaded = 0;
+	auto lastErrorCode = -1;
+
+	_multiplexer.BeginSwap();
+
+	for (auto& library : _libraries)
+	{
+		const auto oldBackend = library.Backend;
+		const auto oldShadowPath = library.ShadowPath;
+
+		try
+		{
+			Install(library);
+		}
+		catch (error_code_exception& error)
+		{
+			lastErrorCode = error.Code();
+			continue;
+		}
+
+		if (oldBackend != nullptr)
+			_multiplexer.RemoveBackend(oldBackend);
+
+		// Best effort: hooked processes may keep the old copy mapped for a while.
+		if (!oldShadowPath.empty())
+			DeleteFile(oldShadowPath.c_str());
+
+		reloaded++;
+	}
+
+	const auto report = _multiplexer.EndSwap();
+
+	if (reloaded == 0)
+		throw error_code_exception("Error reloading hook dll.", lastErrorCode);
+
+	return report;
+}
+
+void HookReloader::Install(Library& library)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesEx(library.SourcePath.c_str(), GetFileExInfoStandard, &attributes))
+		throw error_code_exception("Error loading hook dll.", static_cast<int>(GetLastError()));
+
+	// Recorded whatever the outcome, so a version that fails is retried only once the file changes again.
+	library.AttemptedWriteTime = attributes.ftLastWriteTime;
+
+	// A copy left mapped by some hooked process cannot be overwritten, move on to the next name.
+	std::wstring shadowPath;
+	for (auto attempt = 1; ; attempt++)
+	{
+		shadowPath = _directory + library.Name + L"." + std::to_wstring(GetCurrentProcessId())
+			+ L"." + std::to_wstring(++_generation) + ShadowExtension;
+		if (CopyFile(library.SourcePath.c_str(), shadowPath.c_str(), false))
+			break;
+
+		if (attempt == MaxShadowAttempts)
+			throw error_code_exception("Error copying hook dll.", static_cast<int>(GetLastError()));
+	}
+
+	std::unique_ptr<HookBackend> backend;
+	try
+	{
+		// The hook calls back on the thread that installed it and goes away with it, so it is
+		// installed on the window thread, which pumps messages for as long as the server runs.
+		// Reloads come from the pipe and watcher threads, which do not.
+		if (library.Architecture == HookMultiplexer::getProcessArchitecture())
+			_messageWindow.Invoke([&]
+			{
+				backend = std::make_unique<HookControl>(shadowPath, library.Architecture, _messageWindow.getHandle());
+			});
+		else
+			backend = std::make_unique<HookHostBackend>(_directory + HookHostBackend::getHostFileName(library.Architecture),
+				shadowPath, library.Architecture, _messageWindow.getHandle());
+	}
+	catch (error_code_exception&)
+	{
+		DeleteFile(shadowPath.c_str());
+		throw;
+	}
+
+	library.ShadowPath = shadowPath;
+	library.Backend = backend.get();
+	_multiplexer.AddBackend(std::move(backend));
+}
+
+// Copies left behind by earlier runs, the ones some process still maps cannot be deleted yet.
+void HookReloader::DeleteStaleShadows(const Library& library) const
+{
+	WIN32_FIND_DATA findData;
+	const auto find = FindFirstFile((_directory + library.Name + L".*" + ShadowExtension).c_str(), &findData);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		DeleteFile((_directory + findData.cFileName).c_str());
+	}
+	while (FindNextFile(find, &findData));
+
+	FindClose(find);
+}
+
+bool HookReloader::IsAnyModified()
+{
+	std::lock_guard guard(_reloadLock);
+
+	for (const auto& library : _libraries)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesEx(library.SourcePath.c_str(), GetFileExInfoStandard, &attributes))
+			continue;
+
+		if (CompareFileTime(&attributes.ftLastWriteTime, &library.AttemptedWriteTime) != 0)
+			return true;
+	}
+
+	return false;
+}
+
+void HookReloader::StartWatching()
+{
+	_watchTask = std::thread(&HookReloader::WatchTask, this);
+}
+
+void HookReloader::WatchTask()
+{
+	const auto change = FindFirstChangeNotification(_directory.c_str(), false,
+		FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (change == INVALID_HANDLE_VALUE)
+		return;
+
+	const HANDLE events[] = { _stopEvent, _cancellationToken.getHandle(), change };
+
+	while (WaitForMultipleObjects(3, events, false, INFINITE) == WAIT_OBJECT_0 + 2)
+	{
+		// Let the new version finish copying; changes meanwhile fold into this one.
+		if (WaitForMultipleObjects(2, events, false, ChangeSettleDelay) != WAIT_TIMEOUT)
+			break;
+
+		FindNextChangeNotification(change);
+
+		// Shadow copies live in the same directory, they only wake this loop up.
+		if (!IsAnyModified())
+			continue;
+
+		try
+		{
+			const auto report = Reload();
+			if (_onReloadedCallback != nullptr)
+				_onReloadedCallback(report);
+		}
+		catch (error_code_exception& error)
+		{
+			if (_onReloadFailedCallback != nullptr)
+				_onReloadFailedCallback(error.what(), error.Code());
+		}
+	}
+
+	FindCloseChangeNotification(change);
+}
+
+HookReloader::~HookReloader()
+{
+	SetEvent(_stopEvent);
+	JoinThread(_watchTask, ThreadStopTimeout);
+	CloseHandle(_stopEvent);
+
+	// Unhooked here rather than with the multiplexer, so the current copies can go too.
+	for (const auto& library : _libraries)
+	{
+		if (library.Backend == nullptr)
+			continue;
+
+		_multiplexer.RemoveBackend(library.Backend);
+		DeleteFile(library.ShadowPath.c_str());
+	}
+}
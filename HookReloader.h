@@ -0,0 +1,60 @@
+﻿#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Windows.h>
+
+#include "CancellationToken.h"
+#include "HookMultiplexer.h"
+#include "MessageWindow.h"
+
+// Installs the hook libraries into the multiplexer and swaps them for a newer version
+// on request or when a library file changes. Libraries are always mapped from a shadow
+// copy, so the original file stays replaceable and a new version is a distinct module
+// that is installed before the old one is removed. Copies are named after the process id and
+// a generation, so a restarted server never collides with copies still mapped elsewhere.
+class HookReloader
+{
+public:
+	HookReloader(HookMultiplexer& multiplexer, MessageWindow& messageWindow, const CancellationToken& cancellationToken);
+	HookReloader(const HookReloader &hr) = delete;
+	~HookReloader();
+
+	void AddLibrary(const std::wstring& name, HookArchitecture architecture);
+	void LoadAll();
+	HookSwapReport Reload();
+	void StartWatching();
+	void setOnReloadedCallback(const std::function<void(const HookSwapReport&)>& callback);
+	void setOnReloadFailedCallback(const std::function<void(const char*, int)>& callback);
+
+private:
+	struct Library
+	{
+		std::wstring Name;
+		HookArchitecture Architecture;
+		std::wstring SourcePath;
+		std::wstring ShadowPath;
+		FILETIME AttemptedWriteTime;	// of the last version installed or failed to install
+		const HookBackend* Backend;
+	};
+
+	HookMultiplexer& _multiplexer;
+	MessageWindow& _messageWindow;
+	const CancellationToken& _cancellationToken;
+	std::wstring _directory;
+	std::vector<Library> _libraries;
+	UINT _generation;
+	std::mutex _reloadLock;
+	HANDLE _stopEvent;
+	std::thread _watchTask;
+	std::function<void(const HookSwapReport&)> _onReloadedCallback;
+	std::function<void(const char*, int)> _onReloadFailedCallback;
+
+	void Install(Library& library);
+	void DeleteStaleShadows(const Library& library) const;
+	bool IsAnyModified();
+	void WatchTask();
+};
@@ -0,0 +1,233 @@
+﻿// ReSharper disable CppInconsistentNaming
+#include "LayoutUsageTracker.h"
+
+#include <algorithm>
+
+#include "Protocol.h"
+
+constexpr size_t MaxWindows = 256;
+constexpr size_t MaxPendingRequests = 16;
+constexpr UINT64 RequestAttributionMs = 250;
+constexpr UINT64 SweepIntervalMs = 30000;
+constexpr auto NoSlot = static_cast<size_t>(-1);
+
+LayoutUsageTracker::LayoutUsageTracker(Clock clock, WindowProbe isWindow)
+	: _clock{std::move(clock)}, _isWindow{std::move(isWindow)}, _lastSweep{_clock()}
+{
+	_windowKeys.reserve(MaxWindows);
+	_windows.reserve(MaxWindows);
+	_requests.reserve(MaxPendingRequests);
+}
+
+// Called before the request is passed on, the hook may notify before it returns.
+void LayoutUsageTracker::OnLayoutChangeRequested(HWND window)
+{
+	std::lock_guard guard(_lock);
+
+	if (_requests.size() == MaxPendingRequests)
+		_requests.erase(_requests.begin());
+
+	_requests.push_back({ window, _clock() });
+}
+
+// The request never reached a hook, its window must not take somebody else's switch.
+void LayoutUsageTracker::CancelLayoutChangeRequest(HWND window)
+{
+	std::lock_guard guard(_lock);
+
+	for (auto it = _requests.rbegin(); it != _requests.rend(); ++it)
+	{
+		if (it->Window == window)
+		{
+			_requests.erase(std::next(it).base());
+			return;
+		}
+	}
+}
+
+// Requests are answered in order, so the oldest one still pending takes the notification.
+// One that never got a notification expires and leaves the foreground guess.
+HWND LayoutUsageTracker::AttributeSwitch(HWND foregroundWindow)
+{
+	std::lock_guard guard(_lock);
+	const auto now = _clock();
+
+	const auto firstPending = std::find_if(_requests.begin(), _requests.end(),
+		[now](const RequestEntry& request) { return now - request.RequestedAt <= RequestAttributionMs; });
+	_requests.erase(_requests.begin(), firstPending);
+
+	if (_requests.empty())
+		return foregroundWindow;
+
+	const auto window = _requests.front().Window;
+	_requests.erase(_requests.begin());
+	return window;
+}
+
+void LayoutUsageTracker::OnLayoutChanged(HWND window, const UINT layout)
+{
+	std::lock_guard guard(_lock);
+	const auto now = _clock();
+
+	if (now - _lastSweep >= SweepIntervalMs)
+		EvictClosedWindows(now);
+
+	auto slot = FindWindowSlot(window);
+	if (slot == NoSlot)
+	{
+		slot = AddWindow(window, now);
+	}
+	else
+	{
+		if (_windows[slot].Layout == layout)
+			return;
+		CloseInterval(slot, now);
+	}
+
+	auto& entry = _windows[slot];
+	entry.Layout = layout;
+	entry.ActiveSince = now;
+	entry.LastSwitch = now;
+
+	GetUsage(window, layout).Switches++;
+	GetLayout(layout).Switches++;
+}
+
+// Appends UsageSnapshotHeader and the records, see Protocol.h.
+void LayoutUsageTracker::AppendSnapshot(std::vector<BYTE>& buffer)
+{
+	std::lock_guard guard(_lock);
+	const auto now = _clock();
+
+	EvictClosedWindows(now);
+
+	const UsageSnapshotHeader header{ static_cast<uint32_t>(_usage.size()), static_cast<uint32_t>(_layouts.size()) };
+	auto offset = buffer.size();
+	buffer.resize(offset + sizeof header
+		+ _usage.size() * sizeof(WindowLayoutUsageRecord)
+		+ _layouts.size() * sizeof(LayoutUsageRecord));
+
+	memcpy(buffer.data() + offset, &header, sizeof header);
+	offset += sizeof header;
+
+	for (const auto& usage : _usage)
+	{
+		const auto& window = _windows[FindWindowSlot(usage.Window)];
+		const auto openMs = window.Layout == usage.Layout ? now - window.ActiveSince : 0;
+
+		const WindowLayoutUsageRecord record
+		{
+			static_cast<int32_t>(reinterpret_cast<INT_PTR>(usage.Window)),
+			static_cast<uint32_t>(window.ProcessId),
+			usage.Layout,
+			usage.Switches,
+			usage.DurationMs + openMs,
+		};
+		memcpy(buffer.data() + offset, &record, sizeof record);
+		offset += sizeof record;
+	}
+
+	for (const auto& layout : _layouts)
+	{
+		UINT64 openMs = 0;
+		for (const auto& window : _windows)
+		{
+			if (window.Layout == layout.Layout)
+				openMs += now - window.ActiveSince;
+		}
+
+		const LayoutUsageRecord record{ layout.Layout, layout.Switches, layout.DurationMs + openMs };
+		memcpy(buffer.data() + offset, &record, sizeof record);
+		offset += sizeof record;
+	}
+}
+
+size_t LayoutUsageTracker::FindWindowSlot(HWND window) const
+{
+	const auto it = std::find(_windowKeys.begin(), _windowKeys.end(), window);
+	return it == _windowKeys.end() ? NoSlot : static_cast<size_t>(it - _windowKeys.begin());
+}
+
+size_t LayoutUsageTracker::AddWindow(HWND window, const UINT64 now)
+{
+	if (_windowKeys.size() == MaxWindows)
+		EvictClosedWindows(now);
+
+	if (_windowKeys.size() == MaxWindows)
+	{
+		const auto oldest = std::min_element(_windows.begin(), _windows.end(),
+			[](const WindowEntry& a, const WindowEntry& b) { return a.LastSwitch < b.LastSwitch; });
+		EvictWindow(static_cast<size_t>(oldest - _windows.begin()), now);
+	}
+
+	DWORD processId = 0;
+	GetWindowThreadProcessId(window, &processId);
+
+	_windowKeys.push_back(window);
+	_windows.push_back({ processId, 0, now, now });
+	return _windowKeys.size() - 1;
+}
+
+LayoutUsageTracker::UsageEntry& LayoutUsageTracker::GetUsage(HWND window, const UINT layout)
+{
+	for (auto& usage : _usage)
+	{
+		if (usage.Window == window && usage.Layout == layout)
+			return usage;
+	}
+
+	_usage.push_back({ window, layout, 0, 0 });
+	return _usage.back();
+}
+
+LayoutUsageTracker::LayoutEntry& LayoutUsageTracker::GetLayout(const UINT layout)
+{
+	for (auto& entry : _layouts)
+	{
+		if (entry.Layout == layout)
+			return entry;
+	}
+
+	_layouts.push_back({ layout, 0, 0 });
+	return _layouts.back();
+}
+
+void LayoutUsageTracker::CloseInterval(const size_t slot, const UINT64 now)
+{
+	const auto& window = _windows[slot];
+	const auto elapsed = now - window.ActiveSince;
+
+	GetUsage(_windowKeys[slot], window.Layout).DurationMs += elapsed;
+	GetLayout(window.Layout).DurationMs += elapsed;
+}
+
+// Per-layout totals outlive the window, its own rows go with it.
+void LayoutUsageTracker::EvictWindow(const size_t slot, const UINT64 now)
+{
+	const auto window = _windowKeys[slot];
+	GetLayout(_windows[slot].Layout).DurationMs += now - _windows[slot].ActiveSince;
+
+	_usage.erase(std::remove_if(_usage.begin(), _usage.end(),
+		[window](const UsageEntry& usage) { return usage.Window == window; }), _usage.end());
+
+	_windowKeys[slot] = _windowKeys.back();
+	_windowKeys.pop_back();
+	_windows[slot] = _windows.back();
+	_windows.pop_back();
+}
+
+void LayoutUsageTracker::EvictClosedWindows(const UINT64 now)
+{
+	_lastSweep = now;
+
+	for (auto slot = _windowKeys.size(); slot-- > 0;)
+	{
+		if (!_isWindow(_windowKeys[slot]))
+			EvictWindow(slot, now);
+	}
+}
+
+bool LayoutUsageTracker::IsWindowAlive(HWND window)
+{
+	return IsWindow(window) != FALSE;
+}
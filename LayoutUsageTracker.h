@@ -0,0 +1,79 @@
+﻿#pragma once
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <Windows.h>
+
+// Keeps per-window and per-layout time and switch counts up to date as layout changes arrive.
+// All tables are flat arrays scanned linearly, the window keys apart from the window data.
+// At most MaxWindows windows are tracked: closed windows are evicted periodically and when
+// the table is full, then the least recently switched one.
+// A layout notification does not name the window that switched. A switch ChangeLayout asked
+// for is credited to the requested window when its notification follows the request closely
+// enough, any other switch to the window in the foreground when it is handled.
+// Time in milliseconds and window liveness come from the clock and probe passed in.
+class LayoutUsageTracker
+{
+public:
+	typedef std::function<UINT64()> Clock;
+	typedef std::function<bool(HWND)> WindowProbe;
+
+	explicit LayoutUsageTracker(Clock clock = GetTickCount64, WindowProbe isWindow = IsWindowAlive);
+	LayoutUsageTracker(const LayoutUsageTracker &lut) = delete;
+
+	void OnLayoutChangeRequested(HWND window);
+	void CancelLayoutChangeRequest(HWND window);
+	HWND AttributeSwitch(HWND foregroundWindow);
+	void OnLayoutChanged(HWND window, UINT layout);
+	void AppendSnapshot(std::vector<BYTE>& buffer);
+
+	static bool IsWindowAlive(HWND window);
+
+private:
+	struct WindowEntry
+	{
+		DWORD ProcessId;
+		UINT Layout;
+		UINT64 ActiveSince;
+		UINT64 LastSwitch;
+	};
+
+	struct UsageEntry
+	{
+		HWND Window;
+		UINT Layout;
+		UINT Switches;
+		UINT64 DurationMs;
+	};
+
+	struct RequestEntry
+	{
+		HWND Window;
+		UINT64 RequestedAt;
+	};
+
+	struct LayoutEntry
+	{
+		UINT Layout;
+		UINT Switches;
+		UINT64 DurationMs;
+	};
+
+	std::mutex _lock;
+	std::vector<HWND> _windowKeys;
+	std::vector<WindowEntry> _windows;
+	std::vector<UsageEntry> _usage;
+	std::vector<LayoutEntry> _layouts;
+	std::vector<RequestEntry> _requests;
+	Clock _clock;
+	WindowProbe _isWindow;
+	UINT64 _lastSweep;
+
+	size_t FindWindowSlot(HWND window) const;
+	size_t AddWindow(HWND window, UINT64 now);
+	UsageEntry& GetUsage(HWND window, UINT layout);
+	LayoutEntry& GetLayout(UINT layout);
+	void CloseInterval(size_t slot, UINT64 now);
+	void EvictWindow(size_t slot, UINT64 now);
+	void EvictClosedWindows(UINT64 now);
+};
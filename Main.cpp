@@ -3,46 +3,95 @@
 // ReSharper disable CppClangTidyClangDiagnosticCastFunctionTypeStrict
 #include <iostream>
 #include <Windows.h>
+#include <shellapi.h>
 #include "AppControl.h"
+#include "CancellationToken.h"
 #include "error_code_exception.h"
-#include "HookControl.h"
+#include "HookMultiplexer.h"
+#include "HookReloader.h"
+#include "LayoutUsageTracker.h"
 #include "MessageWindow.h"
-
-enum Command
-{
-	Exit = 1,
-    ChangeLayout = 2,
-};
-
-enum Response
+#include "PipeServer.h"
+#include "Protocol.h"
+#include "StandInHookBackend.h"
+#include "TraceFile.h"
+#include "TraceReplayer.h"
+
+// The command being answered, see RequestIdFlag. Untagged for events and unsolicited errors.
+struct PendingRequest
 {
-	LayoutChanged = 1,
-    Error = 2,
+	bool IsTagged;
+	int Id;
+	bool IsAnswered;
 };
 
 void MsgCaptureProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 void OnDisconnect();
 void OnDataReceived(const BYTE* buffer, const int len);
+void DispatchCommand(const BYTE* buffer, const int len);
 void SendCurrentLayout(UINT layout);
-void ChangeLayoutCommand(const BYTE* buffer);
+void ChangeLayoutCommand(PendingRequest& request, const BYTE* buffer);
 void SendOrPrintError(const char* message, int code);
+void ReplyOrPrintError(PendingRequest& request, const char* message, int code);
+void SendError(const char* message, int code);
+void ReplyError(PendingRequest& request, const char* message, int code);
+void ReloadHookCommand(PendingRequest& request);
+void QueryUsageCommand(PendingRequest& request);
+void SendHookReloaded(const HookSwapReport& report);
+void ReplyHookReloaded(PendingRequest& request, const HookSwapReport& report);
+void SendResponse(PendingRequest& request, const void* buffer, int len);
+void SendCompleted(PendingRequest& request);
+void ReplayTrace(const std::wstring& tracePath, bool isRealTime);
+
+struct HookLibrary
+{
+	const wchar_t* Name;
+	HookArchitecture Architecture;
+};
+
+struct LaunchOptions
+{
+	std::wstring CaptureTracePath;
+	std::wstring ReplayTracePath;
+	bool IsReplayAsap;
+};
+
+LaunchOptions ParseCommandLine();
+
+const std::wstring AppId = ServerAppId;
+const std::wstring PipeName = ServerPipeName;
+// The library of the other bitness runs in its hook host, see HookHostBackend.
+const HookLibrary HookLibraries[] =
+{
+	{ L"NativeLangHook_x86", HookArchitecture::X86 },
+	{ L"NativeLangHook_x64", HookArchitecture::X64 },
+};
+
+const std::wstring ReplaySuffix = L"Replay";
+const std::wstring ReplayReportSuffix = L".report.txt";
+const std::wstring ReplayedTraceSuffix = L".replayed";
+constexpr DWORD ReplayDrainTimeoutMs = 5000;
+constexpr DWORD ReplayDrainPollMs = 10;
+constexpr UINT ReplayLayoutChangedMessageCode = WM_APP;
 
-const std::wstring AppId = L"NativeLangHookWrapper";
-const std::wstring PipeName = AppId + L"IPC";
-const std::wstring HookLibName = L"NativeLangHook_x86";
+// Queued frames get part of the budget, the rest is for stopping the threads.
+constexpr DWORD ShutdownTimeoutMs = 2000;
+constexpr DWORD FlushTimeoutMs = 500;
 
 PipeServer* pPipeServer;
 MessageWindow* pMessageWindow;
-HookControl* pHookControl;
+HookMultiplexer* pHookMultiplexer;
+HookReloader* pHookReloader;
+LayoutUsageTracker* pUsageTracker;
+TraceWriter* pTraceWriter;
 AppControl* pAppControl;
 
-UINT layoutChangedMessageCode;
-
 BYTE sendCurrentLayoutBuffer[sizeof(int) * 2];
 constexpr int layoutChangedResponse = LayoutChanged;
 constexpr int errorResponse = Error;
 
 bool isRunning;
+bool isReplayRunning;
 
 char msgBuffer[256];
 
@@ -51,10 +100,25 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 	//init layout changed buffer
 	memcpy(sendCurrentLayoutBuffer, &layoutChangedResponse, sizeof(int));
 
+	const auto options = ParseCommandLine();
+	const auto isReplay = !options.ReplayTracePath.empty();
+
 	//init app
 	try
 	{
-		AppControl appControl(AppId);
+		// Created first to be destroyed last, the handlers write into it until the very end.
+		// A replay traces itself, so both sides are measured at the same boundary.
+		const auto tracePath = isReplay ? options.ReplayTracePath + ReplayedTraceSuffix : options.CaptureTracePath;
+		std::unique_ptr<TraceWriter> traceWriter;
+		if (!tracePath.empty())
+			traceWriter = std::make_unique<TraceWriter>(tracePath);
+		pTraceWriter = traceWriter.get();
+
+		// Every worker loop waits on it, cancelled once the shutdown begins.
+		CancellationToken shutdownToken;
+
+		// A replay runs next to the production instance, on its own pipe.
+		AppControl appControl(isReplay ? AppId + ReplaySuffix : AppId);
 		pAppControl = &appControl;
 
 		if (!appControl.IsUniqueInstance())
@@ -63,26 +127,63 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 			return 1;
 		}
 
-		PipeServer pipeServer(PipeName);
+		PipeServer pipeServer(isReplay ? PipeName + ReplaySuffix : PipeName, shutdownToken);
 		pPipeServer = &pipeServer;
 		pipeServer.setOnReadCallback(OnDataReceived);
 		pipeServer.setOnDisconnectCallback(OnDisconnect);
 
-		pMessageWindow = new MessageWindow();
-		pMessageWindow->setMsgCaptureProc(MsgCaptureProc);
+		LayoutUsageTracker usageTracker;
+		pUsageTracker = &usageTracker;
+
+		HookMultiplexer hookMultiplexer;
+
+		MessageWindow messageWindow(shutdownToken);
+		pMessageWindow = &messageWindow;
+		messageWindow.setMsgCaptureProc(MsgCaptureProc);
 
-		HookControl hookControl(HookLibName, pMessageWindow->getHandle());
-		pHookControl = &hookControl;
-		layoutChangedMessageCode = hookControl.getLayoutChangedMessageCode();
+		HookReloader hookReloader(hookMultiplexer, messageWindow, shutdownToken);
+		if (isReplay)
+		{
+			hookMultiplexer.AddBackend(std::make_unique<StandInHookBackend>(
+				ReplayLayoutChangedMessageCode, HookMultiplexer::getProcessArchitecture()));
+		}
+		else
+		{
+			for (const auto& library : HookLibraries)
+				hookReloader.AddLibrary(library.Name, library.Architecture);
+			hookReloader.LoadAll();
+			hookReloader.setOnReloadedCallback(SendHookReloaded);
+			// Watcher failures go to the client only, a message box would hold the watcher thread.
+			hookReloader.setOnReloadFailedCallback(SendError);
+			hookReloader.StartWatching();
+		}
+		pHookMultiplexer = &hookMultiplexer;
+		pHookReloader = &hookReloader;
 
 		isRunning = true;
 
 		appControl.SetInitComplete();
 
-		appControl.WaitForExitCommand();
+		if (isReplay)
+			ReplayTrace(options.ReplayTracePath, !options.IsReplayAsap);
+		else
+			appControl.WaitForExitCommand();
+
+		// From here on the exit time is bounded, whatever hangs.
+		appControl.ArmShutdownWatchdog(ShutdownTimeoutMs);
+		isRunning = false;
+
+		pipeServer.Flush(FlushTimeoutMs);
+		shutdownToken.Cancel();
+
+		// Both threads feed each other's handlers, so both stop before anything is destroyed.
+		pipeServer.Stop();
+		messageWindow.Stop();
 	}
 	catch (error_code_exception& error)
 	{
+		// Destroyed while unwinding.
+		pPipeServer = nullptr;
 		SendOrPrintError(error.what(), error.Code());
 
 		if (pAppControl == nullptr)
@@ -94,47 +195,232 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 	return 0;
 }
 
+// Usage: [--capture <trace file>] | [--replay <trace file> [--asap]]
+// A replay writes its own trace next to the replayed one, then the comparison report.
+LaunchOptions ParseCommandLine()
+{
+	LaunchOptions options{};
+	int argc;
+	const auto argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (argv == nullptr)
+		return options;
+
+	for (auto i = 1; i < argc; i++)
+	{
+		const std::wstring arg = argv[i];
+		if (arg == L"--capture" && i + 1 < argc)
+			options.CaptureTracePath = argv[++i];
+		else if (arg == L"--replay" && i + 1 < argc)
+			options.ReplayTracePath = argv[++i];
+		else if (arg == L"--asap")
+			options.IsReplayAsap = true;
+	}
+
+	LocalFree(argv);
+	return options;
+}
+
 void MsgCaptureProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
-	if (uMsg == layoutChangedMessageCode)
+	LARGE_INTEGER startedAt;
+	QueryPerformanceCounter(&startedAt);
+
+	LayoutChangedEvent event;
+
+	if (pHookMultiplexer != nullptr && pHookMultiplexer->TryTranslateMessage(uMsg, lParam, event))
 	{
-		SendCurrentLayout(static_cast<UINT>(lParam));
+		// The notification carries the layout only, see the attribution note in Protocol.h.
+		// A replayed one brings the window credited at capture time instead.
+		const auto window = uMsg == ReplayLayoutChangedMessageCode && isReplayRunning
+			? reinterpret_cast<HWND>(wParam)  // NOLINT(performance-no-int-to-ptr)
+			: pUsageTracker->AttributeSwitch(GetForegroundWindow());
+
+		pUsageTracker->OnLayoutChanged(window, event.Layout);
+		SendCurrentLayout(event.Layout);
+
+		if (pTraceWriter != nullptr)
+		{
+			const UINT payload[] = { event.Layout, static_cast<UINT>(reinterpret_cast<UINT_PTR>(window)) };
+			pTraceWriter->Write(TraceRecordKind::HookEvent, startedAt, payload, sizeof payload);
+		}
 	}
 }
 
 void OnDataReceived(const BYTE* buffer, const int len)
 {
-	const auto command = *reinterpret_cast<const int*>(buffer);
+	LARGE_INTEGER startedAt;
+	QueryPerformanceCounter(&startedAt);
+
+	DispatchCommand(buffer, len);
+
+	if (pTraceWriter != nullptr)
+		pTraceWriter->Write(TraceRecordKind::Command, startedAt, buffer, len);
+}
+
+void DispatchCommand(const BYTE* buffer, const int len)
+{
+	auto command = *reinterpret_cast<const int*>(buffer);
+	auto args = buffer + sizeof(int);
+	auto argsLen = len - static_cast<int>(sizeof(int));
+	PendingRequest request{};
+
+	if ((command & RequestIdFlag) != 0 && argsLen >= static_cast<int>(sizeof(int)))
+	{
+		request.IsTagged = true;
+		request.Id = *reinterpret_cast<const int*>(args);
+		command &= ~RequestIdFlag;
+		args += sizeof(int);
+		argsLen -= static_cast<int>(sizeof(int));
+	}
+
 	switch (command)
 	{
 	case Command::ChangeLayout:
-		if (len == sizeof(int) * 4)
-			ChangeLayoutCommand(reinterpret_cast<const BYTE*>(buffer) + sizeof(int));
+		if (argsLen == sizeof(int) * 3)
+			ChangeLayoutCommand(request, args);
 		else
-			SendOrPrintError("Incorrect command.", -1);
+			ReplyOrPrintError(request, "Incorrect command.", -1);
+		break;
+	case Command::ReloadHook:
+		ReloadHookCommand(request);
+		break;
+	case Command::QueryUsage:
+		QueryUsageCommand(request);
 		break;
 	case Command::Exit:
+		// Queued before the shutdown flushes the pipe.
+		SendCompleted(request);
 		isRunning = false;
 		pAppControl->ExitApp();
 		break;
 	default:
-		SendOrPrintError("Unknown command.", -1);
+		ReplyOrPrintError(request, "Unknown command.", -1);
 	}
+
+	SendCompleted(request);
+}
+
+// Answers a tagged command that got no other reply.
+void SendCompleted(PendingRequest& request)
+{
+	if (!request.IsTagged || request.IsAnswered)
+		return;
+
+	constexpr int completedResponse = Completed;
+	SendResponse(request, &completedResponse, sizeof(int));
 }
 
 void SendCurrentLayout(const UINT layout)
 {
 	constexpr auto bufSize = sizeof(int) * 2;
 	memcpy(sendCurrentLayoutBuffer + sizeof(int), &layout, sizeof(int));
-	pPipeServer->Send(sendCurrentLayoutBuffer, bufSize);
+	pPipeServer->Send(sendCurrentLayoutBuffer, bufSize, true);
 }
 
-void ChangeLayoutCommand(const BYTE* buffer)
+void ChangeLayoutCommand(PendingRequest& request, const BYTE* buffer)
 {
 	const auto hWnd = *reinterpret_cast<const int*>(buffer);
 	const auto klId = *reinterpret_cast<const int*>(buffer + sizeof(int));
 	const auto hkl = *reinterpret_cast<const int*>(buffer + sizeof(int) * 2);
-	pHookControl->ChangeLayoutRequest(reinterpret_cast<HWND>(hWnd), klId, hkl);  // NOLINT(performance-no-int-to-ptr)
+	const auto window = reinterpret_cast<HWND>(hWnd);  // NOLINT(performance-no-int-to-ptr)
+
+	pUsageTracker->OnLayoutChangeRequested(window);
+	if (!pHookMultiplexer->ChangeLayoutRequest(window, klId, hkl))
+	{
+		pUsageTracker->CancelLayoutChangeRequest(window);
+		ReplyOrPrintError(request, "No hook backend available.", -1);
+	}
+}
+
+void ReloadHookCommand(PendingRequest& request)
+{
+	try
+	{
+		ReplyHookReloaded(request, pHookReloader->Reload());
+	}
+	catch (error_code_exception& error)
+	{
+		ReplyOrPrintError(request, error.what(), error.Code());
+	}
+}
+
+void QueryUsageCommand(PendingRequest& request)
+{
+	constexpr int usageSnapshotResponse = UsageSnapshot;
+	std::vector<BYTE> buffer(sizeof(int));
+
+	memcpy(buffer.data(), &usageSnapshotResponse, sizeof(int));
+	pUsageTracker->AppendSnapshot(buffer);
+	SendResponse(request, buffer.data(), static_cast<int>(buffer.size()));
+}
+
+void SendHookReloaded(const HookSwapReport& report)
+{
+	PendingRequest unsolicited{};
+	ReplyHookReloaded(unsolicited, report);
+}
+
+void ReplyHookReloaded(PendingRequest& request, const HookSwapReport& report)
+{
+	const int buffer[] =
+	{
+		HookReloaded,
+		static_cast<int>(report.GapUs),
+		static_cast<int>(report.LostRequests),
+		static_cast<int>(report.DuplicateEvents),
+		static_cast<int>(report.BufferedRequests),
+	};
+	SendResponse(request, buffer, sizeof buffer);
+}
+
+// Response int, request id, then the rest of the untagged response.
+void SendResponse(PendingRequest& request, const void* buffer, const int len)
+{
+	if (!request.IsTagged)
+	{
+		pPipeServer->Send(buffer, len);
+		return;
+	}
+
+	const auto response = *static_cast<const int*>(buffer) | RequestIdFlag;
+	std::vector<BYTE> reply(len + sizeof(int));
+
+	memcpy(reply.data(), &response, sizeof(int));
+	memcpy(reply.data() + sizeof(int), &request.Id, sizeof(int));
+	memcpy(reply.data() + sizeof(int) * 2, static_cast<const BYTE*>(buffer) + sizeof(int), len - sizeof(int));
+
+	request.IsAnswered = true;
+	pPipeServer->Send(reply.data(), static_cast<int>(reply.size()));
+}
+
+// Replays the trace into this very server through its pipe and message window.
+void ReplayTrace(const std::wstring& tracePath, const bool isRealTime)
+{
+	const TraceReader trace(tracePath);
+	ReplayReport report;
+
+	{
+		TraceReplayer replayer(PipeName + ReplaySuffix, pMessageWindow->getHandle(), ReplayLayoutChangedMessageCode);
+
+		isReplayRunning = true;
+		report = replayer.Replay(trace, isRealTime);
+
+		// Commands are traced after their reply went out, events once the message window got to them.
+		const auto sentRecords = report.Records - report.SkippedRecords - report.FailedPosts;
+		const auto deadline = GetTickCount64() + ReplayDrainTimeoutMs;
+		while (pTraceWriter->getRecordCount() < sentRecords && GetTickCount64() < deadline)
+			Sleep(ReplayDrainPollMs);
+
+		// The replayer disconnects once destroyed, which is expected now.
+		isRunning = false;
+	}
+
+	isReplayRunning = false;
+
+	pTraceWriter->Flush();
+	const TraceReader replayed(tracePath + ReplayedTraceSuffix);
+	TraceReplayer::CompareTraces(trace, replayed, report);
+	TraceReplayer::WriteReport(tracePath + ReplayReportSuffix, report);
 }
 
 void OnDisconnect()
@@ -145,11 +431,30 @@ void OnDisconnect()
 	pAppControl->ExitApp();
 }
 
-void SendOrPrintError(const char* message, int code)
+void SendOrPrintError(const char* message, const int code)
+{
+	PendingRequest unsolicited{};
+	ReplyOrPrintError(unsolicited, message, code);
+}
+
+void ReplyOrPrintError(PendingRequest& request, const char* message, const int code)
 {
 	sprintf_s(msgBuffer, "%s Error code: %#08x", message, code);
-	MessageBoxA(nullptr, msgBuffer, "Error", MB_OK);
+	if (!isReplayRunning)
+		MessageBoxA(nullptr, msgBuffer, "Error", MB_OK);
 
+	ReplyError(request, message, code);
+}
+
+void SendError(const char* message, const int code)
+{
+	PendingRequest unsolicited{};
+	ReplyError(unsolicited, message, code);
+}
+
+// Reports to the client only, if there is one.
+void ReplyError(PendingRequest& request, const char* message, const int code)
+{
 	if (pPipeServer == nullptr || !pPipeServer->IsConnected())
 		return;
 
@@ -163,6 +468,6 @@ void SendOrPrintError(const char* message, int code)
 	memcpy(buffer + sizeof(int), &code, sizeof(int));
 	memcpy(buffer + sizeof(int) * 2, message, msgLen);
 	buffer[bufSize - 1] = 0;
-	pPipeServer->Send(buffer, static_cast<int>(bufSize));
+	SendResponse(request, buffer, static_cast<int>(bufSize));
 	delete[] buffer;
 }
\ No newline at end of file
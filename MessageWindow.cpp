@@ -5,14 +5,24 @@
 
 #include "MessageWindow.h"
 #include "error_code_exception.h"
+#include <exception>
 #include <format>
 
 constexpr auto WndClassName = L"{3EEEDD77}_MsgWindowClass";
+constexpr UINT InvokeMessageCode = WM_APP + 1;
 
-MessageWindow::MessageWindow()
+struct InvokeCall
+{
+	const std::function<void()>* Call;
+	std::exception_ptr Error;
+	bool IsDone;
+};
+
+MessageWindow::MessageWindow(const CancellationToken& cancellationToken)
+	: _wndHandle{nullptr}, _cancellationToken{cancellationToken}
 {
 	_initEvent = CreateEvent(nullptr, true, false, nullptr);
-	if (_initEvent == INVALID_HANDLE_VALUE)
+	if (_initEvent == nullptr)
 		throw error_code_exception("Error creating event.", static_cast<int>(GetLastError()));
 
 	InitWindowClass();
@@ -34,8 +44,8 @@ void MessageWindow::InitWindowClass()
 
 void MessageWindow::s_CaptureTaskProc(void* instPtr)
 {
-	int error;
 	MSG msg;
+	auto isRunning = true;
 	const auto pThis = static_cast<MessageWindow*>(instPtr);
 
 	pThis->_wndHandle = CreateWindow(
@@ -53,18 +63,28 @@ void MessageWindow::s_CaptureTaskProc(void* instPtr)
 
 	SetEvent(pThis->_initEvent);
 
-	while ((error = GetMessage(&msg, nullptr, 0, 0)) != 0)
+	// Also wakes up on the shutdown, the loop does not depend on anyone posting to it.
+	const auto cancelEvent = pThis->_cancellationToken.getHandle();
+	while (isRunning)
 	{
-		if (error == -1)
+		if (MsgWaitForMultipleObjects(1, &cancelEvent, false, INFINITE, QS_ALLINPUT) != WAIT_OBJECT_0 + 1)
 		{
-			//Process error
+			DestroyWindow(pThis->_wndHandle);
 			break;
 		}
-		TranslateMessage(&msg);
-		DispatchMessage(&msg);
+
+		while (isRunning && PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+		{
+			if (msg.message == WM_QUIT)
+			{
+				isRunning = false;
+				break;
+			}
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
 	}
 
-	CloseHandle(pThis->_initEvent);
 	UnregisterClass(WndClassName, pThis->_wndClass.hInstance);
 }
 
@@ -101,6 +121,20 @@ LRESULT MessageWindow::WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 	case WM_DESTROY:
 		PostQuitMessage(0);
 		break;
+	case InvokeMessageCode:
+	{
+		const auto invoke = reinterpret_cast<InvokeCall*>(lParam);
+		try
+		{
+			(*invoke->Call)();
+		}
+		catch (...)
+		{
+			invoke->Error = std::current_exception();
+		}
+		invoke->IsDone = true;
+		return 0;
+	}
 	default:
 		if (_captureCallback)
 		{
@@ -111,7 +145,6 @@ LRESULT MessageWindow::WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 	return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
 
-
 HWND MessageWindow::getHandle() const
 {
 	WaitForSingleObject(_initEvent, INFINITE);
@@ -123,8 +156,38 @@ void MessageWindow::setMsgCaptureProc(const std::function<void(HWND, unsigned, W
 	_captureCallback = callback;
 }
 
+void MessageWindow::Invoke(const std::function<void()>& call)
+{
+	const auto window = getHandle();
+	if (GetWindowThreadProcessId(window, nullptr) == GetCurrentThreadId())
+	{
+		call();
+		return;
+	}
+
+	// Returns at once without running the call if the window is already destroyed.
+	InvokeCall invoke{ &call, nullptr, false };
+	SendMessage(window, InvokeMessageCode, 0, reinterpret_cast<LPARAM>(&invoke));
+
+	if (!invoke.IsDone)
+		throw error_code_exception("Message window is closed.", ERROR_INVALID_WINDOW_HANDLE);
+	if (invoke.Error != nullptr)
+		std::rethrow_exception(invoke.Error);
+}
+
+// Ends the message loop, waiting for it for a bounded time. Safe to call more than once.
+void MessageWindow::Stop()
+{
+	if (!_captureTask.joinable())
+		return;
+
+	// Posted, not sent: a busy loop must not block the caller.
+	PostMessage(_wndHandle, WM_CLOSE, 0, 0);
+	JoinThread(_captureTask, ThreadStopTimeout);
+}
+
 MessageWindow::~MessageWindow()
 {
-	SendMessage(_wndHandle, WM_QUIT, 0, 0);
-	_captureTask.join(); // Wait for exiting message loop.
+	Stop();
+	CloseHandle(_initEvent);
 }
\ No newline at end of file
@@ -1,20 +1,26 @@
 ﻿#pragma once
 #include <functional>
+#include <thread>
 #include <Windows.h>
 
-#include "PipeServer.h"
+#include "CancellationToken.h"
 
 class MessageWindow
 {
 public:
-	MessageWindow();
+	explicit MessageWindow(const CancellationToken& cancellationToken);
 	~MessageWindow();
 	MessageWindow(const MessageWindow &mw) = delete;
 	HWND getHandle() const;
+	void Stop();
+	// Runs the call on the window thread and waits for it, rethrowing what it throws.
+	// Hooks installed there are serviced by its message loop.
+	void Invoke(const std::function<void()>& call);
 	void setMsgCaptureProc(const std::function<void(HWND, unsigned int, WPARAM, LPARAM)>& callback);
 
 private:
 	HWND _wndHandle;
+	const CancellationToken& _cancellationToken;
 	HANDLE _initEvent;
 	tagWNDCLASSEXW _wndClass;
 	ATOM _wndClassHandle;
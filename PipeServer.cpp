@@ -1,22 +1,28 @@
 ﻿#include <format>
+#include <vector>
 
 #include "PipeServer.h"
 
 #include "error_code_exception.h"
+#include "Protocol.h"
 
 // ReSharper disable IdentifierTypo
 // ReSharper disable CppInconsistentNaming
 // ReSharper disable CommentTypo
 
-const std::wstring PipeNamePrefix = L"\\\\.\\pipe\\";
+// A client that stopped reading loses the newest layout events rather than the server its memory.
+// Replies are never dropped, there are no more of them than commands the client has sent.
+constexpr size_t MaxQueuedFrames = 1024;
 
-PipeServer::PipeServer(const std::wstring& pipeName)
+PipeServer::PipeServer(const std::wstring& pipeName, const CancellationToken& cancellationToken)
+	: _cancellationToken{cancellationToken}, _isWriting{false}, _isStopping{false}
 {
 	_pipeName = PipeNamePrefix + pipeName;
 
 	InitPipe();
 	ConnectToNewClient();
 	_receiverThread = std::thread(&PipeServer::ReceiveTask, this, &_pipe);
+	_senderThread = std::thread(&PipeServer::SendTask, this);
 }
 
 void PipeServer::InitPipe()
@@ -33,6 +39,12 @@ void PipeServer::InitPipe()
 	if (_pipe.Overlap.hEvent == nullptr)
 		throw error_code_exception("CreateEvent failed.", static_cast<int>(GetLastError()));
 
+	_writeOverlap = {};
+	_writeOverlap.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	_sendEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (_writeOverlap.hEvent == nullptr || _sendEvent == nullptr)
+		throw error_code_exception("CreateEvent failed.", static_cast<int>(GetLastError()));
+
 	_pipe.PipeInst = CreateNamedPipe(
 		_pipeName.c_str(),						// pipe name 
 		PIPE_ACCESS_DUPLEX |					// read/write access 
@@ -83,25 +95,30 @@ void PipeServer::ConnectToNewClient()
 		: READING_STATE; // ready to read
 }
 
-void PipeServer::Send(const void* buffer, const int len)
+// Frames are queued and written by the sender thread, in order and without blocking the caller.
+// A droppable frame is dropped once MaxQueuedFrames are queued, see there.
+void PipeServer::Send(const void* buffer, const int len, const bool isDroppable)
 {
-	DWORD bytesTransfered;
+	// Events, replies and reload reports are sent from different threads.
+	std::lock_guard guard(_sendLock);
 
-	if (_pipe.State != READING_STATE) return;
+	if (_pipe.State != READING_STATE || _isStopping) return;
+	if (isDroppable && _outbound.size() >= MaxQueuedFrames) return;
 
-	reinterpret_cast<int*>(_pipe.WriteBuffer)[0] = len;
-	memcpy(&_pipe.WriteBuffer[sizeof(int)], buffer, len);
-	_pipe.ToWrite = len + sizeof(int);
+	std::vector<BYTE> frame(len + sizeof(int));
+	memcpy(frame.data(), &len, sizeof(int));
+	memcpy(&frame[sizeof(int)], buffer, len);
 
-	const auto isSuccess = WriteFile(
-				_pipe.PipeInst,
-				_pipe.WriteBuffer,
-				_pipe.ToWrite,
-				&bytesTransfered,
-				nullptr);
+	_outbound.push_back(std::move(frame));
+	SetEvent(_sendEvent);
+}
 
-	if (!isSuccess)
-		throw error_code_exception("Send data failed.", static_cast<int>(GetLastError()));
+// Waits for the queued frames to be written. Returns false if the timeout ran out first.
+bool PipeServer::Flush(const DWORD timeoutMs)
+{
+	std::unique_lock lock(_sendLock);
+	return _drained.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+		[this] { return _outbound.empty() && !_isWriting; });
 }
 
 void PipeServer::setOnReadCallback(const std::function<void(const BYTE*, int)>& callback)
@@ -142,11 +159,13 @@ void PipeServer::ReadPending()
 		&_pipe.Read,
 		&_pipe.Overlap);
 
-	// The read operation completed successfully. 
+	// The read operation completed successfully. The event is signaled as well,
+	// so the receive loop issues the next read right away.
 	if (isSuccess && _pipe.Read != 0)
 	{
 		_pipe.IsPendingIO = false;
 		_pipe.State = READING_STATE;
+		OnRead();
 		return;
 	}
 
@@ -165,14 +184,26 @@ void PipeServer::ReceiveTask(PIPEINST* pipe)
 {
 	DWORD bytesTransfered;
 	bool isRunning = true;
+	const HANDLE events[] = { pipe->Overlap.hEvent, _cancellationToken.getHandle() };
 
 	while (isRunning)
 	{
 		// Wait for the event object to be signaled, indicating 
-		// completion of an overlapped read, write, or 
-		// connect operation. 
+		// completion of an overlapped read or connect operation,
+		// or for the shutdown. A cancelled operation completes too.
 
-		WaitForSingleObject(pipe->Overlap.hEvent,INFINITE);
+		if (WaitForMultipleObjects(2, events, false, INFINITE) != WAIT_OBJECT_0
+			|| pipe->State == CLOSING_STATE)
+		{
+			// The read buffer and the OVERLAPPED must outlive the operation, so it is
+			// cancelled and waited for, unless it has completed already.
+			if (pipe->IsPendingIO)
+			{
+				CancelIoEx(pipe->PipeInst, &pipe->Overlap);
+				GetOverlappedResult(pipe->PipeInst, &pipe->Overlap, &bytesTransfered, true);
+			}
+			break;
+		}
 
 		// Get the result if the operation was pending. 
 
@@ -186,11 +217,6 @@ void PipeServer::ReceiveTask(PIPEINST* pipe)
 
 			switch (pipe->State)
 			{
-
-			case CLOSING_STATE:
-				isRunning = false;
-				continue;
-
 			// Pending connect operation 
 			case CONNECTING_STATE:
 				if (!isSuccess)	
@@ -230,19 +256,78 @@ void PipeServer::OnRead() const
 		_onReadCallback(request, msgLen);
 }
 
-PipeServer::~PipeServer()
+void PipeServer::SendTask()
 {
-	_pipe.State = CLOSING_STATE;
+	const HANDLE events[] = { _sendEvent, _cancellationToken.getHandle() };
 
-	if (_pipe.Overlap.hEvent != INVALID_HANDLE_VALUE)
+	while (WaitForMultipleObjects(2, events, false, INFINITE) == WAIT_OBJECT_0)
 	{
-		CloseHandle(_pipe.Overlap.hEvent);
+		std::unique_lock lock(_sendLock);
+		while (!_outbound.empty() && !_isStopping)
+		{
+			const auto frame = std::move(_outbound.front());
+			_outbound.pop_front();
+			_isWriting = true;
+			lock.unlock();
+
+			// A frame that failed belongs to a client that is gone, the receiver handles that.
+			WriteFrame(frame);
+
+			lock.lock();
+			_isWriting = false;
+		}
+		_drained.notify_all();
+
+		if (_isStopping) break;
 	}
+}
 
-	if (_pipe.PipeInst != INVALID_HANDLE_VALUE)
+// Overlapped, so a client that stopped reading cannot block the shutdown.
+bool PipeServer::WriteFrame(const std::vector<BYTE>& frame)
+{
+	DWORD bytesTransfered;
+
+	if (WriteFile(_pipe.PipeInst, frame.data(), static_cast<DWORD>(frame.size()), nullptr, &_writeOverlap))
+		return true;
+
+	if (GetLastError() != ERROR_IO_PENDING)
+		return false;
+
+	const HANDLE events[] = { _writeOverlap.hEvent, _cancellationToken.getHandle() };
+	if (WaitForMultipleObjects(2, events, false, INFINITE) != WAIT_OBJECT_0)
+		CancelIoEx(_pipe.PipeInst, &_writeOverlap);
+
+	// Waits for the cancellation to complete, the buffer must outlive the operation.
+	return GetOverlappedResult(_pipe.PipeInst, &_writeOverlap, &bytesTransfered, true);
+}
+
+// Cancels the pipe I/O and waits for both threads, each for a bounded time, see JoinThread.
+// Frames still queued are dropped, Flush gives them a chance first.
+void PipeServer::Stop()
+{
 	{
-		CancelIoEx(_pipe.PipeInst, &_pipe.Overlap);
-		_receiverThread.join(); //Wait for receiver thread exits.
-		CloseHandle(_pipe.PipeInst);
-	}	
-}
\ No newline at end of file
+		std::lock_guard guard(_sendLock);
+		if (_isStopping) return;
+		_isStopping = true;
+		_outbound.clear();
+	}
+
+	_pipe.State = CLOSING_STATE;
+	SetEvent(_sendEvent);
+
+	// Cancel before anything is closed: the threads are woken by the completion of the cancelled I/O.
+	CancelIoEx(_pipe.PipeInst, nullptr);
+
+	JoinThread(_receiverThread, ThreadStopTimeout);
+	JoinThread(_senderThread, ThreadStopTimeout);
+}
+
+PipeServer::~PipeServer()
+{
+	Stop();
+
+	CloseHandle(_sendEvent);
+	CloseHandle(_writeOverlap.hEvent);
+	CloseHandle(_pipe.Overlap.hEvent);
+	CloseHandle(_pipe.PipeInst);
+}
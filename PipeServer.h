@@ -1,8 +1,14 @@
 #pragma once
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <thread>
+#include <vector>
 #include <windows.h>
 
+#include "CancellationToken.h"
+
 
 // ReSharper disable IdentifierTypo
 // ReSharper disable CppInconsistentNaming
@@ -33,12 +39,14 @@ typedef struct
 class PipeServer
 {
 public:
-	explicit PipeServer(const std::wstring& pipeName);
+	PipeServer(const std::wstring& pipeName, const CancellationToken& cancellationToken);
 	PipeServer() = delete;
 	PipeServer(const PipeServer &ps) = delete;
 	~PipeServer();
 
-	void Send(const void* buffer, int len);
+	void Send(const void* buffer, int len, bool isDroppable = false);
+	bool Flush(DWORD timeoutMs);
+	void Stop();
 	void setOnReadCallback(const std::function<void(const BYTE*, int)>& callback);
 	void setOnDisconnectCallback(const std::function<void()>& callback);
 	bool IsConnected() const;
@@ -46,7 +54,16 @@ public:
 private:
 	PIPEINST _pipe;
 	std::wstring _pipeName;
+	const CancellationToken& _cancellationToken;
 	std::thread _receiverThread;
+	std::thread _senderThread;
+	std::mutex _sendLock;
+	std::condition_variable _drained;
+	std::deque<std::vector<BYTE>> _outbound;
+	HANDLE _sendEvent;
+	OVERLAPPED _writeOverlap;
+	bool _isWriting;
+	bool _isStopping;
 	std::function<void(const BYTE*, int)> _onReadCallback;
 	std::function<void()> _onDisconnectCallback;
 
@@ -55,5 +72,7 @@ private:
 	void ConnectToNewClient();
 	void ReadPending();
 	void ReceiveTask(PIPEINST* pipe);
+	void SendTask();
+	bool WriteFrame(const std::vector<BYTE>& frame);
 	void OnRead() const;
 };
@@ -0,0 +1,64 @@
+﻿#pragma once
+#include <cstdint>
+
+// ReSharper disable CppInconsistentNaming
+
+// Wire protocol shared by the server and the client library.
+// Every frame is a 4-byte payload length followed by the payload;
+// a payload starts with a Command (client to server) or a Response (server to client) int.
+// A command with RequestIdFlag set is followed by a request id, then its arguments. The server
+// answers it with exactly one response: the result, Error or Completed, flagged the same way
+// and followed by the same id. Untagged commands get untagged replies, only on success
+// where there is a result. Events and errors nobody asked for are never tagged.
+
+constexpr auto ServerAppId = L"NativeLangHookWrapper";
+constexpr auto ServerPipeName = L"NativeLangHookWrapperIPC";
+constexpr auto PipeNamePrefix = L"\\\\.\\pipe\\";
+
+constexpr int FrameHeaderSize = sizeof(int);
+constexpr int RequestIdFlag = 0x10000;
+
+enum Command
+{
+	Exit = 1,
+	ChangeLayout = 2,
+	ReloadHook = 3,
+	QueryUsage = 4,
+};
+
+enum Response
+{
+	LayoutChanged = 1,
+	Error = 2,
+	HookReloaded = 3,	// gap us, lost requests, duplicate events, buffered requests; also sent unsolicited
+	UsageSnapshot = 4,	// UsageSnapshotHeader, then the window and layout records
+	Completed = 5,		// answers a tagged command that has no result
+};
+
+// Layout usage snapshot records, durations include the layout active right now.
+// Window attribution is approximate: the hook reports the new layout only. A switch that a
+// ChangeLayout asked for is credited to its hWnd when the notification arrives within 250 ms
+// of the request. Any other switch is credited to the foreground window at the time the
+// server handles the notification, so a focus change in between credits the wrong window.
+
+struct UsageSnapshotHeader
+{
+	uint32_t WindowLayoutCount;
+	uint32_t LayoutCount;
+};
+
+struct WindowLayoutUsageRecord
+{
+	int32_t Window;
+	uint32_t ProcessId;
+	uint32_t Layout;
+	uint32_t Switches;
+	uint64_t DurationMs;
+};
+
+struct LayoutUsageRecord
+{
+	uint32_t Layout;
+	uint32_t Switches;
+	uint64_t DurationMs;
+};
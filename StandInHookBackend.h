@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <atomic>
+#include <Windows.h>
+
+#include "HookBackend.h"
+
+// Backend without a hook library: notifications are fed by whoever knows its message code,
+// layout change requests are only counted.
+class StandInHookBackend final : public HookBackend
+{
+public:
+	StandInHookBackend(UINT layoutChangedMessageCode, HookArchitecture architecture);
+	HookArchitecture getArchitecture() const override;
+	UINT getLayoutChangedMessageCode() const override;
+	void ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const override;
+	UINT64 getRequestCount() const;
+
+private:
+	UINT _layoutChangedMessageCode;
+	HookArchitecture _architecture;
+	mutable std::atomic<UINT64> _requestCount;
+};
+
+inline StandInHookBackend::StandInHookBackend(const UINT layoutChangedMessageCode, const HookArchitecture architecture)
+	: _layoutChangedMessageCode{layoutChangedMessageCode}, _architecture{architecture}, _requestCount{0}
+{ }
+
+inline HookArchitecture StandInHookBackend::getArchitecture() const
+{
+	return _architecture;
+}
+
+inline UINT StandInHookBackend::getLayoutChangedMessageCode() const
+{
+	return _layoutChangedMessageCode;
+}
+
+inline void StandInHookBackend::ChangeLayoutRequest(HWND hWnd, int klId, int hkl) const
+{
+	++_requestCount;
+}
+
+inline UINT64 StandInHookBackend::getRequestCount() const
+{
+	return _requestCount;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+
+// ReSharper disable CppInconsistentNaming
+
+// Minimal test harness. TEST defines and registers a case, CHECK reports a failed
+// condition and lets the case go on. The runner exits with the number of failed cases.
+
+struct TestCase
+{
+	const char* Name;
+	void (*Run)();
+};
+
+inline std::vector<TestCase>& getTestCases()
+{
+	static std::vector<TestCase> testCases;
+	return testCases;
+}
+
+inline int& getCheckFailures()
+{
+	static auto failures = 0;
+	return failures;
+}
+
+inline bool RegisterTest(const char* name, void (*run)())
+{
+	getTestCases().push_back({ name, run });
+	return true;
+}
+
+#define TEST(name) \
+	static void name(); \
+	static const bool name##Registered = RegisterTest(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("  %s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			getCheckFailures()++; \
+		} \
+	} \
+	while (false)
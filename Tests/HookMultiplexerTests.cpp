@@ -0,0 +1,150 @@
+// ReSharper disable CppInconsistentNaming
+// ReSharper disable CppClangTidyPerformanceNoIntToPtr
+#include <memory>
+
+#include "Check.h"
+#include "../HookMultiplexer.h"
+#include "../StandInHookBackend.h"
+
+namespace
+{
+	constexpr UINT X86Code = WM_APP + 1;
+	constexpr UINT X64Code = WM_APP + 2;
+
+	// Stand-in windows: odd handles are x86, even ones x64.
+	const auto X86Window = reinterpret_cast<HWND>(1);
+	const auto X64Window = reinterpret_cast<HWND>(2);
+
+	HookArchitecture ResolveByHandle(HWND hWnd)
+	{
+		return reinterpret_cast<UINT_PTR>(hWnd) % 2 != 0 ? HookArchitecture::X86 : HookArchitecture::X64;
+	}
+
+	StandInHookBackend* AddStandIn(HookMultiplexer& multiplexer, const UINT code, const HookArchitecture architecture)
+	{
+		auto backend = std::make_unique<StandInHookBackend>(code, architecture);
+		const auto standIn = backend.get();
+		multiplexer.AddBackend(std::move(backend));
+		return standIn;
+	}
+}
+
+TEST(RequestsAreRoutedByWindowArchitecture)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	const auto x86 = AddStandIn(multiplexer, X86Code, HookArchitecture::X86);
+	const auto x64 = AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+
+	CHECK(multiplexer.ChangeLayoutRequest(X86Window, 1, 1));
+	CHECK(multiplexer.ChangeLayoutRequest(X64Window, 1, 1));
+	CHECK(multiplexer.ChangeLayoutRequest(X64Window, 1, 1));
+
+	CHECK(x86->getRequestCount() == 1);
+	CHECK(x64->getRequestCount() == 2);
+}
+
+TEST(RequestsFallBackToAnyBackend)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	CHECK(!multiplexer.ChangeLayoutRequest(X86Window, 1, 1));
+
+	const auto x64 = AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+	CHECK(multiplexer.ChangeLayoutRequest(X86Window, 1, 1));
+	CHECK(x64->getRequestCount() == 1);
+}
+
+TEST(NotificationsAreMergedIntoOneSequence)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	AddStandIn(multiplexer, X86Code, HookArchitecture::X86);
+	AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+
+	LayoutChangedEvent first{}, second{}, third{};
+	CHECK(multiplexer.TryTranslateMessage(X64Code, 0x409, first));
+	CHECK(multiplexer.TryTranslateMessage(X86Code, 0x419, second));
+	CHECK(multiplexer.TryTranslateMessage(X64Code, 0x409, third));
+
+	CHECK(first.BackendIndex == 1 && first.Layout == 0x409);
+	CHECK(second.BackendIndex == 0 && second.Layout == 0x419);
+	CHECK(first.Sequence < second.Sequence && second.Sequence < third.Sequence);
+
+	LayoutChangedEvent unrelated{};
+	CHECK(!multiplexer.TryTranslateMessage(WM_TIMER, 0x409, unrelated));
+}
+
+TEST(SwapBuffersRequestsAndFlushesThemInOrder)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	const auto oldBackend = AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+
+	multiplexer.BeginSwap();
+	CHECK(multiplexer.ChangeLayoutRequest(X64Window, 1, 1));
+	CHECK(multiplexer.ChangeLayoutRequest(X64Window, 2, 2));
+	CHECK(oldBackend->getRequestCount() == 0);
+
+	const auto newBackend = AddStandIn(multiplexer, X64Code + 10, HookArchitecture::X64);
+	multiplexer.RemoveBackend(oldBackend);
+	const auto report = multiplexer.EndSwap();
+
+	CHECK(report.BufferedRequests == 2);
+	CHECK(report.LostRequests == 0);
+	CHECK(newBackend->getRequestCount() == 2);
+}
+
+TEST(SwapDropsOnlyDuplicateNotifications)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	const auto oldBackend = AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+
+	multiplexer.BeginSwap();
+	AddStandIn(multiplexer, X64Code + 10, HookArchitecture::X64);
+	multiplexer.RemoveBackend(oldBackend);
+
+	LayoutChangedEvent event{};
+	CHECK(multiplexer.TryTranslateMessage(X64Code + 10, 0x409, event));
+
+	// The old hook reporting the same switch late is a duplicate, a switch only it saw is not.
+	CHECK(!multiplexer.TryTranslateMessage(X64Code, 0x409, event));
+	CHECK(multiplexer.TryTranslateMessage(X64Code, 0x419, event));
+	CHECK(event.BackendIndex == RetiredBackendIndex);
+
+	const auto report = multiplexer.EndSwap();
+	CHECK(report.DuplicateEvents == 1);
+}
+
+TEST(RetiredCodesOutliveTheNextSwap)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	const auto first = AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+
+	multiplexer.BeginSwap();
+	const auto second = AddStandIn(multiplexer, X64Code + 10, HookArchitecture::X64);
+	multiplexer.RemoveBackend(first);
+	multiplexer.EndSwap();
+
+	multiplexer.BeginSwap();
+	AddStandIn(multiplexer, X64Code + 20, HookArchitecture::X64);
+	multiplexer.RemoveBackend(second);
+
+	// The first hook notifies late, after the swap that followed its own.
+	LayoutChangedEvent event{};
+	CHECK(multiplexer.TryTranslateMessage(X64Code, 0x409, event));
+	CHECK(event.BackendIndex == RetiredBackendIndex);
+	CHECK(multiplexer.TryTranslateMessage(X64Code + 10, 0x419, event));
+	CHECK(!multiplexer.TryTranslateMessage(X64Code + 30, 0x407, event));
+	multiplexer.EndSwap();
+}
+
+TEST(SwapCountsRequestsLeftWithoutBackend)
+{
+	HookMultiplexer multiplexer(ResolveByHandle);
+	const auto backend = AddStandIn(multiplexer, X64Code, HookArchitecture::X64);
+
+	multiplexer.BeginSwap();
+	CHECK(multiplexer.ChangeLayoutRequest(X64Window, 1, 1));
+	multiplexer.RemoveBackend(backend);
+
+	const auto report = multiplexer.EndSwap();
+	CHECK(report.BufferedRequests == 1);
+	CHECK(report.LostRequests == 1);
+}
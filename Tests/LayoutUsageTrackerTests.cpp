@@ -0,0 +1,201 @@
+// ReSharper disable CppInconsistentNaming
+// ReSharper disable CppClangTidyPerformanceNoIntToPtr
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include "Check.h"
+#include "../LayoutUsageTracker.h"
+#include "../Protocol.h"
+
+namespace
+{
+	const auto ForegroundWindow = reinterpret_cast<HWND>(10);
+	const auto FirstWindow = reinterpret_cast<HWND>(11);
+	const auto SecondWindow = reinterpret_cast<HWND>(12);
+	constexpr UINT English = 0x0409;
+	constexpr UINT Russian = 0x0419;
+
+	// The clock only moves when the test says so; windows stay open until closed.
+	struct FakeDesktop
+	{
+		UINT64 Now = 1000;
+		std::set<HWND> Closed;
+
+		LayoutUsageTracker CreateTracker()
+		{
+			return LayoutUsageTracker([this] { return Now; },
+				[this](HWND window) { return Closed.count(window) == 0; });
+		}
+	};
+
+	struct Snapshot
+	{
+		UsageSnapshotHeader Header;
+		std::vector<WindowLayoutUsageRecord> Windows;
+		std::vector<LayoutUsageRecord> Layouts;
+		size_t Size;
+
+		const WindowLayoutUsageRecord* FindWindow(HWND window, const UINT layout) const
+		{
+			const auto it = std::find_if(Windows.begin(), Windows.end(), [window, layout](const WindowLayoutUsageRecord& record)
+			{
+				return record.Window == static_cast<int32_t>(reinterpret_cast<INT_PTR>(window)) && record.Layout == layout;
+			});
+			return it == Windows.end() ? nullptr : &*it;
+		}
+
+		const LayoutUsageRecord* FindLayout(const UINT layout) const
+		{
+			const auto it = std::find_if(Layouts.begin(), Layouts.end(),
+				[layout](const LayoutUsageRecord& record) { return record.Layout == layout; });
+			return it == Layouts.end() ? nullptr : &*it;
+		}
+	};
+
+	// Parses what AppendSnapshot wrote after the bytes already in the buffer, as the client does.
+	Snapshot TakeSnapshot(LayoutUsageTracker& tracker, const size_t prefixSize = 0)
+	{
+		std::vector<BYTE> buffer(prefixSize);
+		tracker.AppendSnapshot(buffer);
+
+		Snapshot snapshot{};
+		auto offset = prefixSize;
+		memcpy(&snapshot.Header, buffer.data() + offset, sizeof snapshot.Header);
+		offset += sizeof snapshot.Header;
+
+		snapshot.Windows.resize(snapshot.Header.WindowLayoutCount);
+		memcpy(snapshot.Windows.data(), buffer.data() + offset, snapshot.Windows.size() * sizeof(WindowLayoutUsageRecord));
+		offset += snapshot.Windows.size() * sizeof(WindowLayoutUsageRecord);
+
+		snapshot.Layouts.resize(snapshot.Header.LayoutCount);
+		memcpy(snapshot.Layouts.data(), buffer.data() + offset, snapshot.Layouts.size() * sizeof(LayoutUsageRecord));
+
+		snapshot.Size = buffer.size() - prefixSize;
+		return snapshot;
+	}
+}
+
+TEST(RequestedSwitchesAreCreditedInRequestOrder)
+{
+	LayoutUsageTracker tracker;
+	tracker.OnLayoutChangeRequested(FirstWindow);
+	tracker.OnLayoutChangeRequested(SecondWindow);
+
+	CHECK(tracker.AttributeSwitch(ForegroundWindow) == FirstWindow);
+	CHECK(tracker.AttributeSwitch(ForegroundWindow) == SecondWindow);
+	CHECK(tracker.AttributeSwitch(ForegroundWindow) == ForegroundWindow);
+}
+
+TEST(CancelledRequestLeavesForegroundWindow)
+{
+	LayoutUsageTracker tracker;
+	tracker.OnLayoutChangeRequested(FirstWindow);
+	tracker.CancelLayoutChangeRequest(FirstWindow);
+
+	CHECK(tracker.AttributeSwitch(ForegroundWindow) == ForegroundWindow);
+}
+
+TEST(UnansweredRequestExpires)
+{
+	FakeDesktop desktop;
+	auto tracker = desktop.CreateTracker();
+	tracker.OnLayoutChangeRequested(FirstWindow);
+
+	desktop.Now += 251;	// past RequestAttributionMs
+	CHECK(tracker.AttributeSwitch(ForegroundWindow) == ForegroundWindow);
+}
+
+TEST(DurationsAndSwitchesAreKeptPerWindowAndLayout)
+{
+	FakeDesktop desktop;
+	auto tracker = desktop.CreateTracker();
+
+	tracker.OnLayoutChanged(FirstWindow, English);
+	desktop.Now += 100;
+	tracker.OnLayoutChanged(SecondWindow, Russian);
+	desktop.Now += 200;
+	tracker.OnLayoutChanged(FirstWindow, Russian);
+	tracker.OnLayoutChanged(FirstWindow, Russian);	// no switch
+	desktop.Now += 300;
+
+	// The layouts active right now count up to the snapshot.
+	const auto snapshot = TakeSnapshot(tracker);
+	CHECK(snapshot.Windows.size() == 3);
+	CHECK(snapshot.Layouts.size() == 2);
+
+	const auto firstEnglish = snapshot.FindWindow(FirstWindow, English);
+	const auto firstRussian = snapshot.FindWindow(FirstWindow, Russian);
+	const auto secondRussian = snapshot.FindWindow(SecondWindow, Russian);
+	CHECK(firstEnglish != nullptr && firstEnglish->DurationMs == 300 && firstEnglish->Switches == 1);
+	CHECK(firstRussian != nullptr && firstRussian->DurationMs == 300 && firstRussian->Switches == 1);
+	CHECK(secondRussian != nullptr && secondRussian->DurationMs == 500 && secondRussian->Switches == 1);
+
+	const auto english = snapshot.FindLayout(English);
+	const auto russian = snapshot.FindLayout(Russian);
+	CHECK(english != nullptr && english->DurationMs == 300 && english->Switches == 1);
+	CHECK(russian != nullptr && russian->DurationMs == 800 && russian->Switches == 2);
+}
+
+TEST(WindowTableIsBoundedByLeastRecentSwitch)
+{
+	constexpr auto windowCount = 257;
+	FakeDesktop desktop;
+	auto tracker = desktop.CreateTracker();
+
+	const auto windowAt = [](const int i) { return reinterpret_cast<HWND>(static_cast<INT_PTR>(100 + i)); };
+	for (auto i = 0; i < windowCount; i++)
+	{
+		tracker.OnLayoutChanged(windowAt(i), English);
+		desktop.Now += 10;
+	}
+
+	// The first window was switched longest ago, its time stays with the layout.
+	const auto snapshot = TakeSnapshot(tracker);
+	CHECK(snapshot.Windows.size() == 256);
+	CHECK(snapshot.FindWindow(windowAt(0), English) == nullptr);
+	CHECK(snapshot.FindWindow(windowAt(1), English) != nullptr);
+
+	UINT64 expectedMs = (windowCount - 1) * 10;
+	for (auto i = 1; i < windowCount; i++)
+		expectedMs += (windowCount - i) * 10;
+
+	const auto english = snapshot.FindLayout(English);
+	CHECK(english != nullptr && english->Switches == windowCount && english->DurationMs == expectedMs);
+}
+
+TEST(ClosedWindowsAreEvicted)
+{
+	FakeDesktop desktop;
+	auto tracker = desktop.CreateTracker();
+
+	tracker.OnLayoutChanged(FirstWindow, English);
+	tracker.OnLayoutChanged(SecondWindow, English);
+	desktop.Now += 100;
+	desktop.Closed.insert(FirstWindow);
+
+	const auto snapshot = TakeSnapshot(tracker);
+	CHECK(snapshot.Windows.size() == 1);
+	CHECK(snapshot.FindWindow(SecondWindow, English) != nullptr);
+
+	const auto english = snapshot.FindLayout(English);
+	CHECK(english != nullptr && english->DurationMs == 200);
+}
+
+TEST(SnapshotIsAppendedAfterTheResponseHeader)
+{
+	FakeDesktop desktop;
+	auto tracker = desktop.CreateTracker();
+
+	CHECK(TakeSnapshot(tracker).Size == sizeof(UsageSnapshotHeader));
+
+	tracker.OnLayoutChanged(FirstWindow, English);
+	tracker.OnLayoutChanged(FirstWindow, Russian);
+	tracker.OnLayoutChanged(SecondWindow, Russian);
+
+	const auto snapshot = TakeSnapshot(tracker, sizeof(int) * 2);
+	CHECK(snapshot.Header.WindowLayoutCount == 3);
+	CHECK(snapshot.Header.LayoutCount == 2);
+	CHECK(snapshot.Size == sizeof(UsageSnapshotHeader) + 3 * sizeof(WindowLayoutUsageRecord) + 2 * sizeof(LayoutUsageRecord));
+}
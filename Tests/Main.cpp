@@ -0,0 +1,37 @@
+// ReSharper disable CppInconsistentNaming
+#include <cstring>
+
+#include "Check.h"
+#include "../error_code_exception.h"
+
+// Usage: NativeLangHookTests [name filter]
+int main(const int argc, char* argv[])
+{
+	const auto filter = argc > 1 ? argv[1] : nullptr;
+	auto failedCases = 0;
+
+	for (const auto& testCase : getTestCases())
+	{
+		if (filter != nullptr && strstr(testCase.Name, filter) == nullptr)
+			continue;
+
+		printf("%s\n", testCase.Name);
+		const auto failuresBefore = getCheckFailures();
+
+		try
+		{
+			testCase.Run();
+		}
+		catch (error_code_exception& error)
+		{
+			printf("  unexpected exception: %s (%d)\n", error.what(), error.Code());
+			getCheckFailures()++;
+		}
+
+		if (getCheckFailures() != failuresBefore)
+			failedCases++;
+	}
+
+	printf("%d failed\n", failedCases);
+	return failedCases;
+}
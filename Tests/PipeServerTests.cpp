@@ -0,0 +1,70 @@
+// ReSharper disable CppInconsistentNaming
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "../CancellationToken.h"
+#include "../PipeServer.h"
+#include "../Protocol.h"
+#include "../Client/PipeClient.h"
+
+// Requests pipelined through PipeClient against a PipeServer that answers each one at once.
+// Back-to-back frames make the server reads complete immediately as well as pending.
+
+namespace
+{
+	constexpr int PipelinedRequests = 1000;
+	constexpr auto RepliesTimeout = std::chrono::seconds(10);
+
+	std::wstring GetPipeName()
+	{
+		return L"NativeLangHookTests.Pipeline." + std::to_wstring(GetCurrentProcessId());
+	}
+}
+
+TEST(PipelinedRequestsAreAllAnswered)
+{
+	const auto pipeName = GetPipeName();
+	std::vector<std::future<std::vector<BYTE>>> replies;
+	PipeClient client(pipeName);
+
+	{
+		CancellationToken token;
+		PipeServer server(pipeName, token);
+
+		// Answers every tagged command with Completed and its id, as the server does.
+		server.setOnReadCallback([&server](const BYTE* request, const int len)
+		{
+			if (len < static_cast<int>(sizeof(int) * 2) || (*reinterpret_cast<const int*>(request) & RequestIdFlag) == 0)
+				return;
+
+			const int reply[] = { Completed | RequestIdFlag, *reinterpret_cast<const int*>(request + sizeof(int)) };
+			server.Send(reply, sizeof reply);
+		});
+
+		client.Start();
+		for (auto i = 0; i < PipelinedRequests; i++)
+			replies.push_back(client.Request(QueryUsage, nullptr, 0));
+
+		const auto deadline = std::chrono::steady_clock::now() + RepliesTimeout;
+		auto answered = 0;
+		for (auto& reply : replies)
+		{
+			if (reply.wait_until(deadline) != std::future_status::ready)
+				break;
+
+			const auto payload = reply.get();
+			CHECK(payload.size() == sizeof(int));
+			CHECK(*reinterpret_cast<const int*>(payload.data()) == Completed);
+			answered++;
+		}
+
+		printf("  %d of %d answered\n", answered, PipelinedRequests);
+		CHECK(answered == PipelinedRequests);
+
+		token.Cancel();
+		server.Stop();
+	}
+}
@@ -0,0 +1,117 @@
+// ReSharper disable CppInconsistentNaming
+#include <future>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "../CancellationToken.h"
+#include "../MessageWindow.h"
+#include "../PipeServer.h"
+#include "../Protocol.h"
+#include "../Client/PipeClient.h"
+
+// The server shutdown as in Main.cpp, with the client still connected and I/O in flight.
+// A thread that outlives ThreadStopTimeout terminates the test run, see JoinThread.
+
+namespace
+{
+	constexpr DWORD FlushTimeoutMs = 200;
+	constexpr DWORD ConnectTimeoutMs = 1000;
+	constexpr int PendingFrames = 256;
+	constexpr int PendingFrameSize = 4096;
+
+	std::wstring GetPipeName()
+	{
+		return L"NativeLangHookTests." + std::to_wstring(GetCurrentProcessId());
+	}
+
+	double ElapsedMs(const LARGE_INTEGER& since)
+	{
+		LARGE_INTEGER now, frequency;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&frequency);
+		return static_cast<double>(now.QuadPart - since.QuadPart) * 1000.0 / static_cast<double>(frequency.QuadPart);
+	}
+
+	bool WaitForClient(const PipeServer& server)
+	{
+		const auto deadline = GetTickCount64() + ConnectTimeoutMs;
+		while (!server.IsConnected() && GetTickCount64() < deadline)
+			Sleep(10);
+		return server.IsConnected();
+	}
+
+	// Returns the time the component stops took, the flush excluded.
+	double ShutDown(PipeServer& server, MessageWindow& messageWindow, const CancellationToken& token, double& totalMs)
+	{
+		LARGE_INTEGER startedAt, stopStartedAt;
+		QueryPerformanceCounter(&startedAt);
+
+		server.Flush(FlushTimeoutMs);
+		token.Cancel();
+
+		QueryPerformanceCounter(&stopStartedAt);
+		server.Stop();
+		messageWindow.Stop();
+
+		totalMs = ElapsedMs(startedAt);
+		return ElapsedMs(stopStartedAt);
+	}
+}
+
+TEST(ShutdownIsBoundedWithServerWritesPending)
+{
+	const auto pipeName = GetPipeName();
+	CancellationToken token;
+	PipeServer server(pipeName, token);
+	MessageWindow messageWindow(token);
+
+	// Never reads, so the server writes stay pending once the pipe buffer is full,
+	// and never writes, so the server read stays pending too.
+	const auto client = CreateFile((PipeNamePrefix + pipeName).c_str(), GENERIC_READ | GENERIC_WRITE,
+		0, nullptr, OPEN_EXISTING, 0, nullptr);
+	CHECK(client != INVALID_HANDLE_VALUE);
+	CHECK(WaitForClient(server));
+
+	const std::vector<BYTE> frame(PendingFrameSize);
+	for (auto i = 0; i < PendingFrames; i++)
+		server.Send(frame.data(), static_cast<int>(frame.size()));
+
+	double totalMs;
+	const auto stopMs = ShutDown(server, messageWindow, token, totalMs);
+	printf("  stop %.1f ms, total %.1f ms\n", stopMs, totalMs);
+
+	CHECK(stopMs < ThreadStopTimeout);
+	CHECK(totalMs < FlushTimeoutMs + ThreadStopTimeout);
+
+	CloseHandle(client);
+}
+
+TEST(ShutdownIsBoundedWithClientRequestsPending)
+{
+	const auto pipeName = GetPipeName();
+	std::vector<std::future<std::vector<BYTE>>> replies;
+	PipeClient client(pipeName);
+
+	{
+		CancellationToken token;
+		PipeServer server(pipeName, token);
+		MessageWindow messageWindow(token);
+
+		// Nothing handles the commands, so every request stays waiting for its reply.
+		client.Start();
+		CHECK(WaitForClient(server));
+		for (auto i = 0; i < PendingFrames; i++)
+			replies.push_back(client.QueryUsage());
+
+		double totalMs;
+		const auto stopMs = ShutDown(server, messageWindow, token, totalMs);
+		printf("  stop %.1f ms, total %.1f ms\n", stopMs, totalMs);
+
+		CHECK(stopMs < ThreadStopTimeout);
+		CHECK(totalMs < FlushTimeoutMs + ThreadStopTimeout);
+	}
+
+	// The requests already written fail with the connection once the server is gone.
+	CHECK(replies.front().wait_for(std::chrono::milliseconds(ConnectTimeoutMs)) == std::future_status::ready);
+}
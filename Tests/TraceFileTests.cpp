@@ -0,0 +1,53 @@
+// ReSharper disable CppInconsistentNaming
+#include <string>
+
+#include "Check.h"
+#include "../TraceFile.h"
+
+namespace
+{
+	std::wstring GetTracePath()
+	{
+		wchar_t directory[MAX_PATH];
+		GetTempPath(MAX_PATH, directory);
+		return std::wstring(directory) + L"NativeLangHookTests." + std::to_wstring(GetCurrentProcessId()) + L".trace";
+	}
+
+	LARGE_INTEGER Ticks(const INT64 value)
+	{
+		LARGE_INTEGER ticks;
+		ticks.QuadPart = value;
+		return ticks;
+	}
+}
+
+TEST(TraceRecordsAreReadInStartOrder)
+{
+	const auto path = GetTracePath();
+	const BYTE first = 1, second = 2, third = 3;
+
+	{
+		// Written as handled: the second record started before the first one finished.
+		TraceWriter writer(path);
+		writer.Write(TraceRecordKind::Command, Ticks(1000), &first, sizeof first);
+		writer.Write(TraceRecordKind::HookEvent, Ticks(3000), &third, sizeof third);
+		writer.Write(TraceRecordKind::Command, Ticks(2000), &second, sizeof second);
+		CHECK(writer.getRecordCount() == 3);
+	}
+
+	{
+		const TraceReader reader(path);
+		const auto& records = reader.getRecords();
+
+		CHECK(records.size() == 3);
+		if (records.size() == 3)
+		{
+			CHECK(records[0].Payload[0] == first && records[0].StartedAt == 0);
+			CHECK(records[1].Payload[0] == second && records[1].StartedAt == 1000);
+			CHECK(records[2].Payload[0] == third && records[2].StartedAt == 2000);
+			CHECK(records[2].Kind == TraceRecordKind::HookEvent);
+		}
+	}
+
+	DeleteFile(path.c_str());
+}
@@ -0,0 +1,162 @@
+﻿// ReSharper disable CppInconsistentNaming
+#include "TraceFile.h"
+
+#include <algorithm>
+
+#include "error_code_exception.h"
+
+constexpr char TraceMagic[4] = { 'N', 'L', 'H', 'T' };
+constexpr UINT TraceVersion = 2;
+constexpr size_t TraceHeaderSize = sizeof TraceMagic + sizeof(UINT) + sizeof(INT64);
+constexpr size_t FlushThreshold = 64 * 1024;
+
+TraceWriter::TraceWriter(const std::wstring& path)
+	: _lastStartedAt{0}, _recordCount{0}
+{
+	_file = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		throw error_code_exception("Error creating trace file.", static_cast<int>(GetLastError()));
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	_buffer.reserve(FlushThreshold * 2);
+	_buffer.resize(TraceHeaderSize);
+	memcpy(_buffer.data(), TraceMagic, sizeof TraceMagic);
+	memcpy(_buffer.data() + sizeof TraceMagic, &TraceVersion, sizeof(UINT));
+	memcpy(_buffer.data() + sizeof TraceMagic + sizeof(UINT), &frequency.QuadPart, sizeof(INT64));
+}
+
+// Called once the record was handled, so the processing time is known.
+void TraceWriter::Write(const TraceRecordKind kind, const LARGE_INTEGER& startedAt, const void* payload, const int len)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	std::lock_guard guard(_lock);
+
+	const auto delta = _lastStartedAt == 0 ? 0 : startedAt.QuadPart - _lastStartedAt;
+	_lastStartedAt = startedAt.QuadPart;
+
+	_buffer.push_back(static_cast<BYTE>(kind));
+	AppendVarint((static_cast<UINT64>(delta) << 1) ^ static_cast<UINT64>(delta >> 63));
+	AppendVarint(static_cast<UINT64>(now.QuadPart - startedAt.QuadPart));
+	AppendVarint(static_cast<UINT64>(len));
+	_buffer.insert(_buffer.end(), static_cast<const BYTE*>(payload), static_cast<const BYTE*>(payload) + len);
+	_recordCount++;
+
+	if (_buffer.size() >= FlushThreshold)
+		WriteBuffer();
+}
+
+void TraceWriter::Flush()
+{
+	std::lock_guard guard(_lock);
+	WriteBuffer();
+}
+
+size_t TraceWriter::getRecordCount()
+{
+	std::lock_guard guard(_lock);
+	return _recordCount;
+}
+
+void TraceWriter::AppendVarint(UINT64 value)
+{
+	while (value >= 0x80)
+	{
+		_buffer.push_back(static_cast<BYTE>(value | 0x80));
+		value >>= 7;
+	}
+	_buffer.push_back(static_cast<BYTE>(value));
+}
+
+void TraceWriter::WriteBuffer()
+{
+	DWORD written;
+	WriteFile(_file, _buffer.data(), static_cast<DWORD>(_buffer.size()), &written, nullptr);
+	_buffer.clear();
+}
+
+TraceWriter::~TraceWriter()
+{
+	std::lock_guard guard(_lock);
+	WriteBuffer();
+	CloseHandle(_file);
+}
+
+TraceReader::TraceReader(const std::wstring& path)
+	: _frequency{0}
+{
+	// The trace may still be open for writing, see TraceWriter::Flush.
+	const auto file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw error_code_exception("Error opening trace file.", static_cast<int>(GetLastError()));
+
+	std::vector<BYTE> data;
+	BYTE chunk[FlushThreshold];
+	DWORD read;
+	while (ReadFile(file, chunk, sizeof chunk, &read, nullptr) && read != 0)
+		data.insert(data.end(), chunk, chunk + read);
+	CloseHandle(file);
+
+	UINT version = 0;
+	if (data.size() >= TraceHeaderSize)
+		memcpy(&version, data.data() + sizeof TraceMagic, sizeof(UINT));
+
+	if (data.size() < TraceHeaderSize || memcmp(data.data(), TraceMagic, sizeof TraceMagic) != 0 || version != TraceVersion)
+		throw error_code_exception("Invalid trace file.", -1);
+
+	memcpy(&_frequency, data.data() + sizeof TraceMagic + sizeof(UINT), sizeof(INT64));
+
+	size_t offset = TraceHeaderSize;
+	auto isTruncated = false;
+	const auto readVarint = [&data, &offset, &isTruncated]
+	{
+		UINT64 value = 0;
+		for (auto shift = 0; offset < data.size() && shift < 64; shift += 7)
+		{
+			const auto byte = data[offset++];
+			value |= static_cast<UINT64>(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+		isTruncated = true;
+		return value;
+	};
+
+	INT64 startedAt = 0;
+	while (offset < data.size())
+	{
+		TraceRecord record;
+		record.Kind = static_cast<TraceRecordKind>(data[offset++]);
+
+		const auto zigzag = readVarint();
+		startedAt += static_cast<INT64>(zigzag >> 1) ^ -static_cast<INT64>(zigzag & 1);
+		record.StartedAt = startedAt;
+		record.ProcessingTicks = static_cast<INT64>(readVarint());
+
+		const auto len = readVarint();
+
+		// A capture cut short by a crash still replays up to its last whole record.
+		if (isTruncated || len > data.size() - offset)
+			break;
+
+		record.Payload.assign(data.begin() + static_cast<ptrdiff_t>(offset), data.begin() + static_cast<ptrdiff_t>(offset + len));
+		offset += len;
+		_records.push_back(std::move(record));
+	}
+
+	std::stable_sort(_records.begin(), _records.end(),
+		[](const TraceRecord& a, const TraceRecord& b) { return a.StartedAt < b.StartedAt; });
+}
+
+INT64 TraceReader::getFrequency() const
+{
+	return _frequency;
+}
+
+const std::vector<TraceRecord>& TraceReader::getRecords() const
+{
+	return _records;
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+// Binary trace of the server input.
+// Header: "NLHT", version, QueryPerformanceFrequency of the capturing machine.
+// Record: kind byte, then varints for the start time delta (zigzag, threads may interleave),
+// the processing time and the payload length, then the payload. Times are counter ticks.
+// Records are written once handled, so the reader sorts them back into start order.
+
+enum class TraceRecordKind : BYTE
+{
+	Command = 1,	// payload as passed to the read callback
+	HookEvent = 2,	// payload is the layout and the window credited with the switch, both 32-bit
+};
+
+struct TraceRecord
+{
+	TraceRecordKind Kind;
+	INT64 StartedAt;	// ticks since the first record
+	INT64 ProcessingTicks;
+	std::vector<BYTE> Payload;
+};
+
+class TraceWriter
+{
+public:
+	explicit TraceWriter(const std::wstring& path);
+	TraceWriter(const TraceWriter &tw) = delete;
+	~TraceWriter();
+
+	void Write(TraceRecordKind kind, const LARGE_INTEGER& startedAt, const void* payload, int len);
+	// Makes the records written so far readable by a TraceReader.
+	void Flush();
+	size_t getRecordCount();
+
+private:
+	std::mutex _lock;
+	HANDLE _file;
+	std::vector<BYTE> _buffer;
+	INT64 _lastStartedAt;
+	size_t _recordCount;
+
+	void AppendVarint(UINT64 value);
+	void WriteBuffer();
+};
+
+class TraceReader
+{
+public:
+	explicit TraceReader(const std::wstring& path);
+	TraceReader(const TraceReader &tr) = delete;
+
+	INT64 getFrequency() const;
+	const std::vector<TraceRecord>& getRecords() const;
+
+private:
+	INT64 _frequency;
+	std::vector<TraceRecord> _records;
+};
@@ -0,0 +1,229 @@
+﻿// ReSharper disable CppInconsistentNaming
+#include "TraceReplayer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+
+#include "error_code_exception.h"
+
+constexpr double UsPerSecond = 1000000.0;
+constexpr DWORD ConnectTimeoutMs = 5000;
+constexpr DWORD PostRetryTimeoutMs = 1000;
+constexpr DWORD PostRetryDelayMs = 1;
+constexpr auto RepliesTimeout = std::chrono::seconds(10);	// for all the replies together
+
+TraceReplayer::TraceReplayer(const std::wstring& pipeName, HWND messageWindow, const UINT layoutChangedMessageCode)
+	: _client{pipeName}, _messageWindow{messageWindow}, _layoutChangedMessageCode{layoutChangedMessageCode}
+{ }
+
+ReplayReport TraceReplayer::Replay(const TraceReader& trace, const bool isRealTime)
+{
+	const auto& records = trace.getRecords();
+	ReplayReport report{};
+	report.Records = records.size();
+
+	if (!WaitForConnection())
+		throw error_code_exception("Error connecting to the replay pipe.", ERROR_PIPE_NOT_CONNECTED);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	const auto localFrequency = static_cast<double>(frequency.QuadPart);
+	const auto capturedFrequency = static_cast<double>(trace.getFrequency());
+	const auto firstStartedAt = records.empty() ? 0 : records.front().StartedAt;
+
+	std::vector<std::future<std::vector<BYTE>>> replies;
+	LARGE_INTEGER replayStartedAt, now;
+	QueryPerformanceCounter(&replayStartedAt);
+
+	for (const auto& record : records)
+	{
+		if (!IsReplayable(record))
+		{
+			report.SkippedRecords++;
+			continue;
+		}
+
+		if (isRealTime)
+		{
+			const auto dueAt = replayStartedAt.QuadPart
+				+ static_cast<INT64>(static_cast<double>(record.StartedAt - firstStartedAt) * localFrequency / capturedFrequency);
+
+			// Sleep the bulk of the wait, spin the last couple of milliseconds.
+			for (QueryPerformanceCounter(&now); now.QuadPart < dueAt; QueryPerformanceCounter(&now))
+			{
+				const auto remainingMs = static_cast<DWORD>((dueAt - now.QuadPart) * 1000 / frequency.QuadPart);
+				Sleep(remainingMs > 2 ? remainingMs - 2 : 0);
+			}
+		}
+
+		const auto payload = record.Payload.data();
+		if (record.Kind == TraceRecordKind::HookEvent)
+		{
+			const auto layout = reinterpret_cast<const UINT*>(payload)[0];
+			const auto window = reinterpret_cast<const UINT*>(payload)[1];
+			if (!PostHookEvent(window, layout))
+				report.FailedPosts++;
+			continue;
+		}
+
+		// The client tags the command with a request id of its own.
+		auto command = *reinterpret_cast<const int*>(payload);
+		auto args = payload + sizeof(int);
+		auto argsLen = static_cast<int>(record.Payload.size() - sizeof(int));
+		if ((command & RequestIdFlag) != 0 && argsLen >= static_cast<int>(sizeof(int)))
+		{
+			command &= ~RequestIdFlag;
+			args += sizeof(int);
+			argsLen -= static_cast<int>(sizeof(int));
+		}
+
+		replies.push_back(_client.Request(static_cast<Command>(command), args, argsLen));
+	}
+
+	const auto repliesDeadline = std::chrono::steady_clock::now() + RepliesTimeout;
+	for (auto& reply : replies)
+	{
+		try
+		{
+			if (reply.wait_until(repliesDeadline) != std::future_status::ready)
+				throw error_code_exception("Replay request timed out.", WAIT_TIMEOUT);
+			reply.get();
+		}
+		catch (error_code_exception&)
+		{
+			report.FailedRequests++;
+		}
+	}
+
+	report.Client = _client.getStatistics();
+	return report;
+}
+
+bool TraceReplayer::WaitForConnection()
+{
+	// The callback stays with the client, it is called again on every reconnect.
+	const auto connected = std::make_shared<std::promise<void>>();
+	const auto isSet = std::make_shared<bool>(false);
+	auto isConnected = connected->get_future();
+
+	_client.setOnConnectionChangedCallback([connected, isSet](const bool isUp)
+	{
+		if (isUp && !*isSet)
+		{
+			*isSet = true;
+			connected->set_value();
+		}
+	});
+	_client.Start();
+
+	return isConnected.wait_for(std::chrono::milliseconds(ConnectTimeoutMs)) == std::future_status::ready;
+}
+
+// A full message queue holds the replay back until the server catches up, up to PostRetryTimeoutMs.
+bool TraceReplayer::PostHookEvent(const UINT window, const UINT layout) const
+{
+	const auto deadline = GetTickCount64() + PostRetryTimeoutMs;
+
+	while (!PostMessage(_messageWindow, _layoutChangedMessageCode, window, layout))
+	{
+		if (GetLastError() != ERROR_NOT_ENOUGH_QUOTA || GetTickCount64() >= deadline)
+			return false;
+		Sleep(PostRetryDelayMs);
+	}
+
+	return true;
+}
+
+// Both traces are measured by the server handlers, the capture by the production one.
+void TraceReplayer::CompareTraces(const TraceReader& captured, const TraceReader& replayed, ReplayReport& report)
+{
+	report.ReplayedRecords = replayed.getRecords().size();
+	report.CapturedSpanUs = Summarize(captured, true, report.Captured, report.CapturedThroughput);
+	report.ReplayedSpanUs = Summarize(replayed, false, report.Replayed, report.ReplayedThroughput);
+}
+
+bool TraceReplayer::IsReplayable(const TraceRecord& record)
+{
+	if (record.Kind == TraceRecordKind::HookEvent)
+		return record.Payload.size() >= sizeof(UINT) * 2;
+
+	if (record.Kind != TraceRecordKind::Command || record.Payload.size() < sizeof(int))
+		return false;
+
+	const auto command = *reinterpret_cast<const int*>(record.Payload.data()) & ~RequestIdFlag;
+	return command != Command::Exit && command != Command::ReloadHook;
+}
+
+// Returns the span from the first start to the last finish.
+double TraceReplayer::Summarize(const TraceReader& trace, const bool isReplayableOnly, LatencyStatistics& statistics, double& throughput)
+{
+	const auto frequency = static_cast<double>(trace.getFrequency());
+	std::vector<double> latenciesUs;
+	INT64 start = 0, end = 0;
+
+	for (const auto& record : trace.getRecords())
+	{
+		if (isReplayableOnly && !IsReplayable(record))
+			continue;
+
+		start = latenciesUs.empty() ? record.StartedAt : (std::min)(start, record.StartedAt);
+		end = latenciesUs.empty() ? record.StartedAt + record.ProcessingTicks : (std::max)(end, record.StartedAt + record.ProcessingTicks);
+		latenciesUs.push_back(static_cast<double>(record.ProcessingTicks) * UsPerSecond / frequency);
+	}
+
+	const auto spanUs = static_cast<double>(end - start) * UsPerSecond / frequency;
+	throughput = spanUs > 0 ? static_cast<double>(latenciesUs.size()) * UsPerSecond / spanUs : 0;
+	statistics = CalculateStatistics(latenciesUs);
+	return spanUs;
+}
+
+LatencyStatistics TraceReplayer::CalculateStatistics(std::vector<double>& latenciesUs)
+{
+	if (latenciesUs.empty())
+		return {};
+
+	std::sort(latenciesUs.begin(), latenciesUs.end());
+
+	double total = 0;
+	for (const auto latency : latenciesUs)
+		total += latency;
+
+	const auto percentile = [&latenciesUs](const double rank)
+	{
+		return latenciesUs[static_cast<size_t>(rank * static_cast<double>(latenciesUs.size() - 1))];
+	};
+
+	return { total / static_cast<double>(latenciesUs.size()), percentile(0.5), percentile(0.99), latenciesUs.back() };
+}
+
+void TraceReplayer::WriteReport(const std::wstring& path, const ReplayReport& report)
+{
+	std::ofstream file(std::filesystem::path(path), std::ios::trunc);
+	if (!file)
+		throw error_code_exception("Error creating replay report.", -1);
+
+	const auto delta = [](const double captured, const double replayed)
+	{
+		return captured > 0 ? (replayed - captured) * 100.0 / captured : 0.0;
+	};
+
+	const auto row = [&file, &delta](const char* name, const double captured, const double replayed)
+	{
+		file << std::format("{:<22}{:>14.2f}{:>14.2f}{:>+10.1f}%\n", name, captured, replayed, delta(captured, replayed));
+	};
+
+	file << std::format("Records: {}, skipped: {}, replayed: {}, failed requests: {}, failed posts: {}\n\n",
+		report.Records, report.SkippedRecords, report.ReplayedRecords, report.FailedRequests, report.FailedPosts);
+	file << std::format("{:<22}{:>14}{:>14}{:>11}\n", "", "captured", "replayed", "delta");
+	row("Span, ms", report.CapturedSpanUs / 1000, report.ReplayedSpanUs / 1000);
+	row("Throughput, rec/s", report.CapturedThroughput, report.ReplayedThroughput);
+	row("Latency mean, us", report.Captured.MeanUs, report.Replayed.MeanUs);
+	row("Latency p50, us", report.Captured.P50Us, report.Replayed.P50Us);
+	row("Latency p99, us", report.Captured.P99Us, report.Replayed.P99Us);
+	row("Latency max, us", report.Captured.MaxUs, report.Replayed.MaxUs);
+	file << std::format("\nClient: send {:.2f} us mean, {:.2f} us max; reply {:.2f} us mean\n",
+		report.Client.MeanSendLatencyUs, report.Client.MaxSendLatencyUs, report.Client.MeanReplyLatencyUs);
+}
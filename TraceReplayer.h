@@ -0,0 +1,61 @@
+﻿#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include "Client/PipeClient.h"
+#include "TraceFile.h"
+
+struct LatencyStatistics
+{
+	double MeanUs;
+	double P50Us;
+	double P99Us;
+	double MaxUs;
+};
+
+struct ReplayReport
+{
+	size_t Records;
+	size_t SkippedRecords;
+	size_t ReplayedRecords;		// as traced by the replaying server
+	size_t FailedRequests;
+	size_t FailedPosts;			// hook events the message queue had no room for
+	double CapturedSpanUs;
+	double ReplayedSpanUs;
+	double CapturedThroughput;	// records per second
+	double ReplayedThroughput;
+	LatencyStatistics Captured;
+	LatencyStatistics Replayed;
+	PipeClientStatistics Client;
+};
+
+// Feeds a captured trace to a server started for the replay, either at the original pace
+// or as fast as possible. Commands go through its pipe and hook events through its message
+// window, so they take the same path as in production. The server traces what it handles
+// at the same boundary as the capture, and the report compares the two traces.
+class TraceReplayer
+{
+public:
+	TraceReplayer(const std::wstring& pipeName, HWND messageWindow, UINT layoutChangedMessageCode);
+	TraceReplayer(const TraceReplayer &tr) = delete;
+
+	// Returns once every request is answered. Records, SkippedRecords, FailedRequests, FailedPosts
+	// and Client are filled in.
+	ReplayReport Replay(const TraceReader& trace, bool isRealTime);
+	static void CompareTraces(const TraceReader& captured, const TraceReader& replayed, ReplayReport& report);
+	static void WriteReport(const std::wstring& path, const ReplayReport& report);
+	// Exit and ReloadHook would end the replay or load the real hook libraries.
+	static bool IsReplayable(const TraceRecord& record);
+
+private:
+	PipeClient _client;
+	HWND _messageWindow;
+	UINT _layoutChangedMessageCode;
+
+	bool WaitForConnection();
+	bool PostHookEvent(UINT window, UINT layout) const;
+	static LatencyStatistics CalculateStatistics(std::vector<double>& latenciesUs);
+	static double Summarize(const TraceReader& trace, bool isReplayableOnly, LatencyStatistics& statistics, double& throughput);
+};